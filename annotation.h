@@ -0,0 +1,306 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_ANNOTATION_H
+#define IUCOUNT_ANNOTATION_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <htslib/bgzf.h>
+#include <htslib/kstring.h>
+#include "intron.h"
+using namespace std;
+
+/* introns of the transcripts of a gtf or gff3 annotation, the native replacement of
+ * script/processIntrons.R. Exons are grouped by transcript and sorted by position, the gaps between
+ * consecutive exons are the introns. An intron shared by several transcripts is kept once, with the
+ * distinct genes and transcripts using it joined by commas */
+struct Transcript{
+    string id;
+    uint32_t chrom;
+    char strand;
+    string geneId;
+    string geneName;
+    string name;
+    vector<pair<uint32_t, uint32_t>> exons; //1-based, inclusive
+};
+struct IntronAttributes{
+    vector<string> geneIds;
+    vector<string> transcriptIds;
+    vector<string> geneNames;
+    vector<string> transcriptNames;
+};
+//whether the file is named as a gtf or gff annotation, compressed or not
+inline bool isAnnotation(const char *fn){
+    string name=fn;
+    if (name.size()>3 && name.compare(name.size()-3, 3, ".gz")==0) name.resize(name.size()-3);
+    for (auto extension: {".gtf", ".gff", ".gff3"}){
+        size_t n=strlen(extension);
+        if (name.size()>n && name.compare(name.size()-n, n, extension)==0) return true;
+    }
+    return false;
+}
+/* the value of an attribute, from either of
+ *   gtf:  gene_id "ENSG00000223972"; gene_name "DDX11L1";
+ *   gff3: ID=exon:ENSE00002234944;Parent=transcript:ENST00000456328
+ * a ';' within quotes is part of the value */
+inline bool getAttribute(const char *attributes, bool gff, const char *key, string *value){
+    size_t n=strlen(key);
+    const char *p=attributes;
+    while (*p){
+        while (*p==' ' || *p==';') ++p;
+        const char *end=p;
+        for (bool quoted=false; *end && (quoted || *end!=';'); ++end) if (*end=='"') quoted=!quoted;
+        if (strncmp(p, key, n)==0 && p[n]==(gff?'=':' ')){
+            const char *v=p+n+1;
+            while (v<end && (*v==' ' || *v=='"')) ++v;
+            const char *e=end;
+            while (e>v && (e[-1]==' ' || e[-1]=='"')) --e;
+            value->assign(v, e-v);
+            return true;
+        }
+        p=end;
+    }
+    return false;
+}
+//append a value to a comma separated list unless it is already there
+inline void appendDistinct(string *list, const string &value){
+    if (list->empty()){
+        *list=value;
+        return;
+    }
+    size_t i=0;
+    while (i<=list->size()){
+        size_t j=list->find(',', i);
+        if (j==string::npos) j=list->size();
+        if (list->compare(i, j-i, value)==0) return;
+        i=j+1;
+    }
+    *list+=',';
+    *list+=value;
+}
+inline bool invalidAnnotation(const char *fn, const string &message){
+    cerr<<"[error] the annotation "<<fn<<" is not valid: "<<message<<endl;
+    return false;
+}
+/* read the introns of an annotation into the intron set, sorted by chromosome in order of appearance,
+ * start, end and strand. The genes and transcripts of each intron are kept if attributes is given.
+ * Returns false if the annotation can not be read or is not valid */
+inline bool extractIntrons(const char *fn, struct IntronSet *introns, struct IntronAttributes *attributes){
+    BGZF *fp=bgzf_open(fn, "r");
+    if (!fp){
+        cerr<<"[error] failed to open "<<fn<<endl;
+        return false;
+    }
+    vector<struct Transcript> transcripts;
+    unordered_map<string, uint32_t> transcriptIds;
+    //for gff3, the parent and name of every feature with an id, to find the genes of transcripts
+    unordered_map<string, pair<string, string>> features;
+    vector<string> chromNames;
+    unordered_map<string, uint32_t> chromIds;
+    kstring_t line={0, 0, nullptr};
+    char *items[9];
+    string value, parents, parent;
+    uint64_t lineNumber=0;
+    uint32_t last=0;
+    int ret;
+    bool valid=true;
+    while (valid && (ret=bgzf_getline(fp, '\n', &line))>=0){
+        ++lineNumber;
+        if (line.l==0) continue;
+        //the sequences of a gff3 file follow its features
+        if (strncmp(line.s, "##FASTA", 7)==0) break;
+        if (line.s[0]=='#') continue;
+        if (line.s[line.l-1]=='\r') line.s[--line.l]='\0';
+        int n=0;
+        for (char *p=line.s; n<9 && p; ++n){
+            items[n]=p;
+            if ((p=strchr(p, '\t'))!=nullptr) *p++='\0';
+        }
+        if (n<9){
+            valid=invalidAnnotation(fn, "line "+to_string(lineNumber)+" has less than 9 columns");
+            break;
+        }
+        //gff3 attributes are key=value, gtf attributes are key "value"
+        bool gff=items[8][strcspn(items[8], " =")]=='=';
+        if (strcmp(items[2], "exon")!=0){
+            if (gff && getAttribute(items[8], gff, "ID", &value)){
+                auto &feature=features[value];
+                getAttribute(items[8], gff, "Parent", &feature.first);
+                getAttribute(items[8], gff, "Name", &feature.second);
+            }
+            continue;
+        }
+        if (!getAttribute(items[8], gff, "transcript_id", &parents) && !(gff && getAttribute(items[8], gff, "Parent", &parents))){
+            valid=invalidAnnotation(fn, "exon without transcript at line "+to_string(lineNumber));
+            break;
+        }
+        auto chrom=chromIds.find(items[0]);
+        if (chrom==chromIds.end()){
+            chrom=chromIds.emplace(items[0], chromNames.size()).first;
+            chromNames.emplace_back(items[0]);
+        }
+        uint32_t exonStart=strtoul(items[3], nullptr, 10);
+        uint32_t exonEnd=strtoul(items[4], nullptr, 10);
+        //an exon of gff3 may belong to several transcripts
+        size_t i=0;
+        while (i<=parents.size()){
+            size_t j=gff?parents.find(',', i):string::npos;
+            if (j==string::npos) j=parents.size();
+            parent=parents.substr(i, j-i);
+            i=j+1;
+            //exons of a transcript are usually listed together, so the last transcript is checked first
+            if (transcripts.empty() || transcripts[last].id!=parent){
+                auto it=transcriptIds.find(parent);
+                if (it==transcriptIds.end()){
+                    it=transcriptIds.emplace(parent, transcripts.size()).first;
+                    transcripts.emplace_back();
+                    auto &transcript=transcripts.back();
+                    transcript.id=parent;
+                    transcript.chrom=chrom->second;
+                    transcript.strand=*items[6];
+                    if (getAttribute(items[8], gff, "gene_id", &value)) transcript.geneId=value;
+                    if (getAttribute(items[8], gff, "gene_name", &value)) transcript.geneName=value;
+                    if (getAttribute(items[8], gff, "transcript_name", &value)) transcript.name=value;
+                }
+                last=it->second;
+            }
+            auto &transcript=transcripts[last];
+            if (transcript.chrom!=chrom->second || transcript.strand!=*items[6]){
+                valid=invalidAnnotation(fn, "transcript "+parent+" has exons on different chromosomes or strands");
+                break;
+            }
+            transcript.exons.emplace_back(exonStart, exonEnd);
+        }
+    }
+    free(line.s);
+    bgzf_close(fp);
+    if (!valid) return false;
+    if (ret<-1) return invalidAnnotation(fn, "failed to read line "+to_string(lineNumber+1));
+
+    //the introns of every transcript, the first transcript using an intron decides its position in the list
+    vector<unordered_map<uint64_t, uint32_t>> seen(chromNames.size()*2);
+    struct IntronAttributes found;
+    vector<uint32_t> foundChroms, foundStarts, foundEnds;
+    vector<char> foundStrands;
+    uint64_t unstranded=0;
+    for (auto &transcript: transcripts){
+        if (transcript.strand!='+' && transcript.strand!='-'){
+            if (transcript.exons.size()>1) ++unstranded;
+            continue;
+        }
+        auto feature=features.find(transcript.id);
+        if (feature!=features.end()){
+            if (transcript.name.empty()) transcript.name=feature->second.second;
+            auto gene=features.find(feature->second.first);
+            if (transcript.geneId.empty()) transcript.geneId=feature->second.first;
+            if (gene!=features.end() && transcript.geneName.empty()) transcript.geneName=gene->second.second;
+        }
+        sort(transcript.exons.begin(), transcript.exons.end());
+        for (size_t i=1; i<transcript.exons.size(); ++i){
+            uint32_t start=transcript.exons[i-1].second, end=transcript.exons[i].first-1;
+            if (start>=end) return invalidAnnotation(fn, "transcript "+transcript.id+" has overlapping or adjacent exons");
+            uint64_t key=(uint64_t)start<<32u|end;
+            auto &introns=seen[transcript.chrom*2+(transcript.strand=='-')];
+            auto it=introns.find(key);
+            if (it==introns.end()){
+                it=introns.emplace(key, foundStarts.size()).first;
+                foundChroms.push_back(transcript.chrom);
+                foundStarts.push_back(start);
+                foundEnds.push_back(end);
+                foundStrands.push_back(transcript.strand);
+                found.geneIds.emplace_back();
+                found.transcriptIds.emplace_back();
+                found.geneNames.emplace_back();
+                found.transcriptNames.emplace_back();
+            }
+            if (!attributes) continue;
+            appendDistinct(&found.geneIds[it->second], transcript.geneId.empty()?".":transcript.geneId);
+            appendDistinct(&found.transcriptIds[it->second], transcript.id);
+            appendDistinct(&found.geneNames[it->second], transcript.geneName.empty()?".":transcript.geneName);
+            appendDistinct(&found.transcriptNames[it->second], transcript.name.empty()?".":transcript.name);
+        }
+    }
+    if (unstranded) cerr<<"[warning] "<<unstranded<<" transcripts without strand are left out"<<endl;
+
+    vector<uint32_t> order(foundStarts.size());
+    for (uint32_t i=0; i<order.size(); ++i) order[i]=i;
+    sort(order.begin(), order.end(), [&](uint32_t i, uint32_t j){
+        if (foundChroms[i]!=foundChroms[j]) return foundChroms[i]<foundChroms[j];
+        if (foundStarts[i]!=foundStarts[j]) return foundStarts[i]<foundStarts[j];
+        if (foundEnds[i]!=foundEnds[j]) return foundEnds[i]<foundEnds[j];
+        return foundStrands[i]<foundStrands[j];
+    });
+    for (auto i: order){
+        introns->add(chromNames[foundChroms[i]].c_str(), foundStarts[i], foundEnds[i], foundStrands[i]);
+        if (!attributes) continue;
+        attributes->geneIds.push_back(move(found.geneIds[i]));
+        attributes->transcriptIds.push_back(move(found.transcriptIds[i]));
+        attributes->geneNames.push_back(move(found.geneNames[i]));
+        attributes->transcriptNames.push_back(move(found.transcriptNames[i]));
+    }
+    return true;
+}
+/* the introns of an intron file, only the first four columns of which are read, or of an annotation.
+ * Returns false if the file can not be read */
+inline bool readIntrons(const char *fn, struct IntronSet *introns){
+    if (isAnnotation(fn)) return extractIntrons(fn, introns, nullptr);
+    ifstream infile(fn);
+    if (!infile){
+        cerr<<"[error] failed to open "<<fn<<endl;
+        return false;
+    }
+    string line;
+    char *items[4];
+    while (getline(infile, line)){
+        if (line.empty() || line[0]=='#') continue;
+        int n=0;
+        for (char *p=&line[0]; n<4 && p; ++n){
+            items[n]=p;
+            if ((p=strchr(p, '\t'))!=nullptr) *p++='\0';
+        }
+        if (n==4 && *items[3]) introns->add(items[0], strtol(items[1], nullptr, 10), strtol(items[2], nullptr, 10), *items[3]);
+    }
+    return !infile.bad();
+}
+//the intron file read by iucount: chrom, start, end, strand, gene ids, transcript ids, gene names, transcript names
+inline int writeIntrons(const char *fn, const struct IntronSet &introns, const struct IntronAttributes &attributes){
+    ofstream outfile;
+    outfile.open(fn);
+    if (!outfile) return 0;
+    for (size_t i=0; i<introns.size(); ++i){
+        outfile<<introns.chromName(introns.chroms[i])<<'\t'<<introns.starts[i]<<'\t'<<introns.ends[i]<<'\t'<<introns.strands[i]<<'\t'
+               <<attributes.geneIds[i]<<'\t'<<attributes.transcriptIds[i]<<'\t'<<attributes.geneNames[i]<<'\t'<<attributes.transcriptNames[i]<<'\n';
+    }
+    outfile.close();
+    return !outfile.fail();
+}
+
+#endif
@@ -23,12 +23,19 @@
    SOFTWARE.
  */
 
+#ifndef IUCOUNT_BAM_H
+#define IUCOUNT_BAM_H
+
+#include <iostream>
+#include <string>
 #include <unordered_map>
 #include <map>
 #include <vector>
+#include <stdlib.h>
 #include <string.h>
 #include <htslib/bgzf.h>
 #include <htslib/sam.h>
+#include <htslib/thread_pool.h>
 using namespace std;
 
 #define isUnmapped(b) (((b)->core.flag & BAM_FUNMAP) != 0)
@@ -59,29 +66,53 @@ using namespace std;
 
 class bamReader{
 public:
+    htsFile *hts;
     BGZF *fp;
     bam_hdr_t *header;
+    hts_idx_t *idx;
+    hts_itr_t *itr;
+    htsThreadPool threads;
     bam1_t *b;
     bam1_t *b2;
     unordered_map<string, uint32_t> chr2index;
     unordered_map<int, uint64_t> offset;
+    vector<int> chroms; //chromosomes holding records, in file order
 
     explicit bamReader(const char *fn){
+        hts=nullptr;
         fp=nullptr;
         header=nullptr;
+        idx=nullptr;
+        itr=nullptr;
+        threads={nullptr, 0};
         b=nullptr;
         b2=nullptr;
         open(fn);
     }
     explicit bamReader(){
+        hts=nullptr;
         fp=nullptr;
         header=nullptr;
+        idx=nullptr;
+        itr=nullptr;
+        threads={nullptr, 0};
         b=nullptr;
         b2=nullptr;
     }
+    /* bam, cram and sam files are all read through hts_open/sam_read1. fp is the underlying bgzf
+     * stream of a bam file, used to record and seek to chromosome offsets without an index */
     int open(const char *fn){
-        fp=bgzf_open(fn, "r");
-        header=bam_hdr_read(fp);
+        hts=hts_open(fn, "r");
+        if (!hts){
+            cerr<<"[error] failed to open "<<fn<<endl;
+            return 0;
+        }
+        fp=isBam()?hts->fp.bgzf:nullptr;
+        header=sam_hdr_read(hts);
+        if (!header){
+            cerr<<"[error] failed to read the header of "<<fn<<endl;
+            return 0;
+        }
         b=bam_init1();
         b2=bam_init1();
         for (int i=0; i<header->n_targets; ++i) chr2index[header->target_name[i]]=i;
@@ -92,23 +123,102 @@ public:
         if (b) bam_destroy1(b);
         if (b2) bam_destroy1(b2);
         bgzf_seek(fp, 0, SEEK_SET);
-        header=bam_hdr_read(fp);
+        header=sam_hdr_read(hts);
         b=bam_init1();
         b2=bam_init1();
         return 1;
     }
+    bool isBam() const{
+        return hts_get_format(hts)->format==bam;
+    }
+    bool isCram() const{
+        return hts_get_format(hts)->format==cram;
+    }
+    /* only decode the given SAM_* fields of cram records, the others such as the sequence and the
+     * qualities are skipped. Other formats decode every field */
+    int setRequiredFields(int fields){
+        if (!isCram()) return 1;
+        return hts_set_opt(hts, CRAM_OPT_REQUIRED_FIELDS, fields)==0 && hts_set_opt(hts, CRAM_OPT_DECODE_MD, 0)==0;
+    }
+    //reference sequence to decode a cram file with, instead of the one named in its header
+    int setReference(const char *fn){
+        if (!isCram()) return 1;
+        return hts_set_fai_filename(hts, fn)==0;
+    }
+    /* decompress bgzf blocks on a shared thread pool, qsize blocks are read ahead
+     * of the counting loop */
+    int attachThreadPool(hts_tpool *pool, int qsize){
+        threads.pool=pool;
+        threads.qsize=qsize;
+        return hts_set_thread_pool(hts, &threads)==0;
+    }
+    /* load the .bai/.csi/.crai index next to the alignment file, chromosomes are then
+     * visited through index iterators and the full scan in parse() is not needed.
+     * A crai index holds no record counts, so every chromosome is visited */
+    int loadIndex(const char *fn){
+        idx=sam_index_load(hts, fn);
+        if (!idx) return 0;
+        uint64_t mapped, unmapped;
+        for (int i=0; i<header->n_targets; ++i)
+            if (isCram() || (hts_idx_get_stat(idx, i, &mapped, &unmapped)==0 && mapped+unmapped>0)) chroms.push_back(i);
+        return 1;
+    }
     int jumpToChrom(const char* chrom){
-        return bgzf_seek(fp, offset[chr2index[chrom]], SEEK_SET);
+        return seek(chr2index[chrom]);
     }
     int seek(int id){
+        return seek(id, 0, HTS_POS_MAX);
+    }
+    //without an index the whole chromosome is visited whatever the range
+    int seek(int id, hts_pos_t start, hts_pos_t end){
+        if (idx){
+            if (itr) hts_itr_destroy(itr);
+            itr=sam_itr_queryi(idx, id, start, end);
+            return itr?0:-1;
+        }
         return bgzf_seek(fp, offset[id], SEEK_SET);
     }
+    /* visit the records overlapping any of the sorted and disjoint regions [first, last) of a chromosome,
+     * each once and in order. The regions are given by id and position, so that chromosome names are never
+     * parsed. An index is required */
+    int seek(int id, const pair<int32_t, int32_t> *first, const pair<int32_t, int32_t> *last){
+        if (itr) hts_itr_destroy(itr);
+        itr=nullptr;
+        if (first==last) return -1;
+        //the iterator takes the region list and frees it when destroyed
+        auto reglist=(hts_reglist_t*)calloc(1, sizeof(hts_reglist_t));
+        auto intervals=(hts_pair_pos_t*)malloc((last-first)*sizeof(hts_pair_pos_t));
+        if (!reglist || !intervals){
+            free(reglist);
+            free(intervals);
+            return -1;
+        }
+        for (auto region=first; region!=last; ++region) intervals[region-first]={region->first, region->second};
+        reglist->reg=header->target_name[id];
+        reglist->intervals=intervals;
+        reglist->tid=id;
+        reglist->count=last-first;
+        reglist->min_beg=first->first;
+        reglist->max_end=prev(last)->second;
+        itr=sam_itr_regions(idx, header, reglist, 1);
+        return itr?0:-1;
+    }
+    //number of records on a chromosome as recorded in the index, 0 if unknown
+    uint64_t records(int id){
+        uint64_t mapped, unmapped;
+        if (idx && hts_idx_get_stat(idx, id, &mapped, &unmapped)==0) return mapped+unmapped;
+        return 0;
+    }
     bam1_t* next(){
-        if (bam_read1(fp, b)>0) return b;
+        if (itr){
+            if (sam_itr_next(hts, itr, b)>=0) return b;
+            else return nullptr;
+        }
+        if (sam_read1(hts, header, b)>=0) return b;
         else return nullptr;
     }
     bam1_t* next2(){
-        if (bam_read1(fp, b2)>0) return b2;
+        if (sam_read1(hts, header, b2)>=0) return b2;
         else return nullptr;
     }
     static int return_with_error(const char* message, int ret){
@@ -118,7 +228,9 @@ public:
         }
         return 0;
     }
+    //record the offset of every chromosome of a bam file, other formats can only be read in a single pass
     int parse(){
+        if (!isBam()) return 0;
         reopen();
         int last_coor=0;
         int last_tid=-1;
@@ -131,7 +243,10 @@ public:
             if (tid>=0 && last_tid!=tid){
                 if (no_coor) return_with_error("unsorted bam", -1);
                 if (offset.find(tid)!=offset.end()) return_with_error("chromosome not continuous", -1);
-                else offset[tid]=last_offset;
+                else {
+                    offset[tid]=last_offset;
+                    chroms.push_back(tid);
+                }
             }
             else if (tid >= 0 && last_coor > (b->core.pos)) return_with_error("unsorted bam", 0);
             last_tid=tid;
@@ -141,10 +256,24 @@ public:
         reopen();
         return 1;
     }
-    ~bamReader(){
-        if (fp) bgzf_close(fp);
+    void close(){
+        if (itr) hts_itr_destroy(itr);
+        if (idx) hts_idx_destroy(idx);
+        if (hts) hts_close(hts);
         if (header) bam_hdr_destroy(header);
         if (b) bam_destroy1(b);
         if (b2) bam_destroy1(b2);
+        hts=nullptr;
+        fp=nullptr;
+        header=nullptr;
+        idx=nullptr;
+        itr=nullptr;
+        b=nullptr;
+        b2=nullptr;
     }
-};
\ No newline at end of file
+    ~bamReader(){
+        close();
+    }
+};
+
+#endif
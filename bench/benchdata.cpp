@@ -0,0 +1,370 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* synthetic data for the end-to-end benchmarks: an intron file and a sorted, indexed bam file of reads
+ * from genes laid out along a few chromosomes. Genes have lognormal exon and intron lengths, some are
+ * nested in an intron of the previous gene, and their expression is lognormal. Fragments come from the
+ * mature transcript, skipping each inner exon with some probability, or from the unspliced gene. The
+ * random numbers are drawn from mt19937_64 only, whose output the standard fixes, so that a seed gives
+ * the same data with any compiler. */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <cmath>
+#include <string.h>
+#include <getopt.h>
+#include <htslib/sam.h>
+#include "../utility.h"
+using namespace std;
+
+struct Settings{
+    const char *prefix="benchdata";
+    uint64_t seed=1;
+    int chroms=4;
+    int genes=500; //per chromosome
+    double exons=8; //mean exons per gene
+    double exonLength=150; //median
+    double intronLength=1500; //median
+    double intronSigma=1.0;
+    double nesting=0.1; //genes placed in an intron of the previous gene
+    double depth=20; //mean coverage of the transcripts
+    int readLength=100;
+    bool paired=false;
+    double fragmentLength=300;
+    int libraryType=FRUNSTRANDED;
+    double mature=0.8; //fragments from the spliced transcript, the others are unspliced
+    double skip=0.1; //inner exons skipped per fragment
+    double multi=0.1; //reads with NH above 1
+    int threads=1;
+    string order="coordinate"; //or name, or random
+};
+struct Settings settings;
+
+struct Random{
+    mt19937_64 engine;
+    explicit Random(uint64_t seed): engine(seed){}
+    double uniform(){return (engine()>>11)*0x1.0p-53;}
+    uint64_t below(uint64_t n){return engine()%n;}
+    bool chance(double p){return uniform()<p;}
+    double normal(){
+        double u=1-uniform(), v=uniform();
+        return sqrt(-2*log(u))*cos(2*M_PI*v);
+    }
+    double lognormal(double median, double sigma){return median*exp(sigma*normal());}
+};
+
+struct Gene{
+    char strand;
+    vector<pair<int32_t, int32_t>> exons;
+    int32_t start() const{return exons.front().first;}
+    int32_t end() const{return exons.back().second;}
+};
+struct Record{
+    int32_t tid;
+    int32_t position;
+    uint16_t flag;
+    uint8_t nh;
+    int32_t matePosition;
+    int32_t fragmentLength;
+    uint64_t name;
+    vector<uint32_t> cigar;
+};
+
+Gene makeGene(Random &random, int32_t start){
+    Gene gene;
+    gene.strand=random.chance(0.5)?'+':'-';
+    int n=2;
+    while (n<100 && random.chance(1-1/(settings.exons-1))) ++n; //geometric, with the given mean
+    int32_t position=start;
+    for (int i=0; i<n; ++i){
+        //drawn before max, a macro of utility.h evaluating its arguments twice
+        if (i>0){
+            int32_t intronLength=random.lognormal(settings.intronLength, settings.intronSigma);
+            position+=max(intronLength, 70);
+        }
+        int32_t length=random.lognormal(settings.exonLength, 0.5);
+        length=max(length, 30);
+        gene.exons.emplace_back(position, position+length);
+        position+=length;
+    }
+    return gene;
+}
+//genes of a chromosome from left to right, a gene nested in the longest intron of the previous one if it fits
+vector<Gene> layoutGenes(Random &random, int32_t *length){
+    vector<Gene> genes;
+    int32_t cursor=10000;
+    for (int g=0; g<settings.genes; ++g){
+        if (!genes.empty() && random.chance(settings.nesting)){
+            const Gene &host=genes.back();
+            size_t longest=0;
+            for (size_t i=1; i+1<host.exons.size(); ++i)
+                if (host.exons[i+1].first-host.exons[i].second>host.exons[longest+1].first-host.exons[longest].second) longest=i;
+            int32_t intronStart=host.exons[longest].second, intronEnd=host.exons[longest+1].first;
+            Gene gene=makeGene(random, intronStart+200);
+            if (gene.end()+200<intronEnd){
+                genes.push_back(gene);
+                continue;
+            }
+        }
+        Gene gene=makeGene(random, cursor);
+        cursor=max(cursor, gene.end())+(int32_t)random.lognormal(10000, 1.0);
+        genes.push_back(gene);
+    }
+    *length=cursor+10000;
+    return genes;
+}
+//the genomic alignment of [start, end) of a transcript given as its exons
+void alignSpan(const vector<pair<int32_t, int32_t>> &blocks, int32_t start, int32_t end, int32_t *position, vector<uint32_t> *cigar){
+    cigar->clear();
+    int32_t offset=0, last=-1;
+    for (auto &block: blocks){
+        int32_t length=block.second-block.first;
+        int32_t from=max(start, offset), to=min(end, offset+length);
+        if (from<to){
+            int32_t genomic=block.first+from-offset;
+            if (last<0) *position=genomic;
+            else cigar->push_back((uint32_t)(genomic-last)<<BAM_CIGAR_SHIFT|BAM_CREF_SKIP);
+            cigar->push_back((uint32_t)(to-from)<<BAM_CIGAR_SHIFT|BAM_CMATCH);
+            last=block.first+to-offset;
+        }
+        offset+=length;
+    }
+}
+//the fragments of a gene, with the strand flags of the library type
+void sampleReads(Random &random, int tid, const Gene &gene, uint64_t *name, vector<Record> *records){
+    int32_t transcriptLength=0;
+    for (auto &exon: gene.exons) transcriptLength+=exon.second-exon.first;
+    double expression=random.lognormal(1, 1.0);
+    int readsPerFragment=settings.paired?2:1;
+    uint64_t fragments=(uint64_t)(settings.depth*expression*transcriptLength/(settings.readLength*readsPerFragment));
+    vector<pair<int32_t, int32_t>> blocks;
+    for (uint64_t f=0; f<fragments; ++f){
+        blocks.clear();
+        if (random.chance(settings.mature)){
+            for (size_t i=0; i<gene.exons.size(); ++i)
+                if (i==0 || i+1==gene.exons.size() || !random.chance(settings.skip)) blocks.push_back(gene.exons[i]);
+        }
+        else blocks.emplace_back(gene.start(), gene.end());
+        int32_t length=0;
+        for (auto &block: blocks) length+=block.second-block.first;
+        int32_t fragmentLength=settings.readLength;
+        if (settings.paired){
+            fragmentLength=settings.fragmentLength+settings.fragmentLength/6*random.normal();
+            fragmentLength=max(fragmentLength, settings.readLength);
+        }
+        if (length<fragmentLength) continue;
+        int32_t start=random.below(length-fragmentLength+1);
+        //the first read is on the opposite strand of the gene for fr-firststrand, on its strand for fr-secondstrand
+        bool sense=settings.libraryType==FRSECONDSTRAND || (settings.libraryType==FRUNSTRANDED && random.chance(0.5));
+        bool firstReverse=(gene.strand=='-')==sense;
+        uint8_t nh=random.chance(settings.multi)?2+random.below(4):1;
+        Record first, second;
+        alignSpan(blocks, start, start+settings.readLength, &first.position, &first.cigar);
+        first.tid=tid;
+        first.nh=nh;
+        first.name=*name;
+        if (!settings.paired){
+            first.flag=firstReverse?BAM_FREVERSE:0;
+            first.matePosition=-1;
+            first.fragmentLength=0;
+            records->push_back(move(first));
+            ++*name;
+            continue;
+        }
+        second=first;
+        alignSpan(blocks, start+fragmentLength-settings.readLength, start+fragmentLength, &second.position, &second.cigar);
+        first.flag=BAM_FPAIRED|BAM_FPROPER_PAIR|BAM_FREAD1|(firstReverse?BAM_FREVERSE:BAM_FMREVERSE);
+        second.flag=BAM_FPAIRED|BAM_FPROPER_PAIR|BAM_FREAD2|(firstReverse?BAM_FMREVERSE:BAM_FREVERSE);
+        first.matePosition=second.position;
+        second.matePosition=first.position;
+        int32_t span=0;
+        for (auto c: second.cigar) span+=bam_cigar_oplen(c);
+        int32_t size=second.position+span-first.position;
+        bool forwardLeft=firstReverse; //the forward mate is the leftmost one
+        first.fragmentLength=forwardLeft?-size:size;
+        second.fragmentLength=-first.fragmentLength;
+        records->push_back(move(first));
+        records->push_back(move(second));
+        ++*name;
+    }
+}
+void usage(){
+    fprintf(stderr, "%s", "benchdata: write synthetic introns and reads for the benchmarks.\n\
+Usage:  benchdata [options]\n\
+-o/--prefix            : output prefix of <prefix>.introns.txt and <prefix>.bam with its index, default benchdata.\n\
+-S/--seed              : random seed, default 1.\n\
+-C/--chroms            : chromosomes, default 4.\n\
+-g/--genes             : genes per chromosome, default 500.\n\
+-e/--exons             : mean exons per gene, default 8.\n\
+-E/--exon-length       : median exon length, default 150.\n\
+-I/--intron-length     : median intron length, default 1500.\n\
+-z/--intron-sigma      : sigma of the lognormal intron lengths, default 1.\n\
+-n/--nesting           : fraction of genes nested in an intron of the previous gene, default 0.1.\n\
+-d/--depth             : mean coverage of the transcripts, default 20.\n\
+-r/--read-length       : read length, default 100.\n\
+-p/--paired            : paired-end reads.\n\
+-F/--fragment-length   : mean fragment length of paired-end reads, default 300.\n\
+-t/--library-type      : fr-firststrand, fr-secondstrand or fr-unstranded, default fr-unstranded.\n\
+-m/--mature            : fraction of fragments from the spliced transcript, default 0.8.\n\
+-k/--skip              : probability to skip an inner exon, default 0.1.\n\
+-M/--multi             : fraction of reads with several alignments, default 0.1.\n\
+-@/--threads           : compression threads, default 1.\n\
+-O/--order             : order of the reads, coordinate, name or random, default coordinate. Only coordinate\n\
+                         sorted reads are indexed.\n\
+");
+    exit(1);
+}
+void parseArgs(int argc, char *argv[]){
+    const struct option longOptions[]={
+        {"prefix", required_argument, NULL, 'o'},
+        {"seed", required_argument, NULL, 'S'},
+        {"chroms", required_argument, NULL, 'C'},
+        {"genes", required_argument, NULL, 'g'},
+        {"exons", required_argument, NULL, 'e'},
+        {"exon-length", required_argument, NULL, 'E'},
+        {"intron-length", required_argument, NULL, 'I'},
+        {"intron-sigma", required_argument, NULL, 'z'},
+        {"nesting", required_argument, NULL, 'n'},
+        {"depth", required_argument, NULL, 'd'},
+        {"read-length", required_argument, NULL, 'r'},
+        {"paired", no_argument, NULL, 'p'},
+        {"fragment-length", required_argument, NULL, 'F'},
+        {"library-type", required_argument, NULL, 't'},
+        {"mature", required_argument, NULL, 'm'},
+        {"skip", required_argument, NULL, 'k'},
+        {"multi", required_argument, NULL, 'M'},
+        {"threads", required_argument, NULL, '@'},
+        {"order", required_argument, NULL, 'O'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int c;
+    while ((c=getopt_long(argc, argv, "ho:S:C:g:e:E:I:z:n:d:r:pF:t:m:k:M:@:O:", longOptions, NULL))>=0){
+        switch (c){
+            case 'o': settings.prefix=optarg; break;
+            case 'S': settings.seed=strtoull(optarg, nullptr, 10); break;
+            case 'C': settings.chroms=atoi(optarg); break;
+            case 'g': settings.genes=atoi(optarg); break;
+            case 'e': settings.exons=max(atof(optarg), 2.0); break;
+            case 'E': settings.exonLength=atof(optarg); break;
+            case 'I': settings.intronLength=atof(optarg); break;
+            case 'z': settings.intronSigma=atof(optarg); break;
+            case 'n': settings.nesting=atof(optarg); break;
+            case 'd': settings.depth=atof(optarg); break;
+            case 'r': settings.readLength=atoi(optarg); break;
+            case 'p': settings.paired=true; break;
+            case 'F': settings.fragmentLength=atof(optarg); break;
+            case 't':
+                if (strcmp(optarg, "fr-firststrand")==0) settings.libraryType=FRFIRSTSTRAND;
+                else if (strcmp(optarg, "fr-secondstrand")==0) settings.libraryType=FRSECONDSTRAND;
+                else if (strcmp(optarg, "fr-unstranded")==0) settings.libraryType=FRUNSTRANDED;
+                else usage();
+                break;
+            case 'm': settings.mature=atof(optarg); break;
+            case 'k': settings.skip=atof(optarg); break;
+            case 'M': settings.multi=atof(optarg); break;
+            case '@': settings.threads=atoi(optarg); break;
+            case 'O': settings.order=optarg; break;
+            default: usage();
+        }
+    }
+    if (settings.chroms<1 || settings.genes<1 || settings.readLength<1 || settings.depth<0) usage();
+    if (settings.order!="coordinate" && settings.order!="name" && settings.order!="random") usage();
+}
+int main(int argc, char *argv[]){
+    parseArgs(argc, argv);
+    Random random(settings.seed);
+    string prefix=settings.prefix;
+    string header="@HD\tVN:1.6\tSO:"+string(settings.order=="coordinate"?"coordinate":settings.order=="name"?"queryname":"unsorted")+"\n";
+    vector<Record> records;
+    uint64_t name=0;
+    size_t intronCount=0;
+    ofstream intronFile(prefix+".introns.txt");
+    if (!intronFile){
+        cerr<<"[error] failed to write "<<prefix<<".introns.txt"<<endl;
+        exit(1);
+    }
+    for (int tid=0; tid<settings.chroms; ++tid){
+        string chrom="chr"+to_string(tid+1);
+        int32_t length;
+        auto genes=layoutGenes(random, &length);
+        header+="@SQ\tSN:"+chrom+"\tLN:"+to_string(length)+"\n";
+        for (size_t g=0; g<genes.size(); ++g){
+            auto &gene=genes[g];
+            for (size_t i=0; i+1<gene.exons.size(); ++i, ++intronCount)
+                intronFile<<chrom<<'\t'<<gene.exons[i].second<<'\t'<<gene.exons[i+1].first<<'\t'<<gene.strand<<'\t'<<chrom<<".g"<<g+1<<'\n';
+            sampleReads(random, tid, gene, &name, &records);
+        }
+    }
+    intronFile.close();
+    if (settings.order=="coordinate") sort(records.begin(), records.end(), [](const Record &i, const Record &j){
+        if (i.tid!=j.tid) return i.tid<j.tid;
+        if (i.position!=j.position) return i.position<j.position;
+        if (i.name!=j.name) return i.name<j.name;
+        return i.flag<j.flag;
+    });
+    //the fragments are already in name order, with the first mate first
+    else if (settings.order=="random")
+        for (size_t i=records.size(); i>1; --i) swap(records[i-1], records[random.below(i)]);
+
+    string bamFile=prefix+".bam";
+    samFile *out=sam_open(bamFile.c_str(), "wb");
+    sam_hdr_t *hdr=out?sam_hdr_parse(header.size(), header.c_str()):nullptr;
+    if (!hdr){
+        cerr<<"[error] failed to write "<<bamFile<<endl;
+        exit(1);
+    }
+    if (settings.threads>1) hts_set_threads(out, settings.threads);
+    if (sam_hdr_write(out, hdr)<0){
+        cerr<<"[error] failed to write "<<bamFile<<endl;
+        exit(1);
+    }
+    bam1_t *b=bam_init1();
+    char qname[32];
+    for (auto &record: records){
+        snprintf(qname, sizeof(qname), "r%llu", (unsigned long long)record.name);
+        bool paired=record.flag & BAM_FPAIRED;
+        bam_set1(b, strlen(qname), qname, record.flag, record.tid, record.position, record.nh==1?60:1, record.cigar.size(), record.cigar.data(),
+                 paired?record.tid:-1, record.matePosition, record.fragmentLength, 0, nullptr, nullptr, 8);
+        bam_aux_append(b, "NH", 'C', 1, &record.nh);
+        if (sam_write1(out, hdr, b)<0){
+            cerr<<"[error] failed to write "<<bamFile<<endl;
+            exit(1);
+        }
+    }
+    bam_destroy1(b);
+    sam_hdr_destroy(hdr);
+    sam_close(out);
+    if (settings.order=="coordinate" && sam_index_build(bamFile.c_str(), 0)<0){
+        cerr<<"[error] failed to index "<<bamFile<<endl;
+        exit(1);
+    }
+    cerr<<"wrote "<<intronCount<<" introns and "<<records.size()<<" reads of "<<name<<(settings.paired?" fragments":" reads")<<" on "<<settings.chroms<<" chromosomes"<<endl;
+    return 0;
+}
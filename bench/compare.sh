@@ -0,0 +1,29 @@
+#!/bin/bash
+# Compare two reports of bench/run.sh: records/s of the end-to-end runs with the ratio of the new report to
+# the old one, then for the rows of the micro benchmarks the ratio of each numeric column.
+#   bench/compare.sh <old report> <new report>
+[ $# -eq 2 ] || { echo "usage: compare.sh <old report> <new report>" >&2; exit 1; }
+awk -F'\t' -v OFS='\t' '
+FNR==1 {++file}
+$1=="#commit" {commit[file]=substr($2, 1, 10)}
+$1=="end2end" {
+    key=$2 OFS $3
+    if (file==1) {old[key]=$6; next}
+    if (!(key in old)) next
+    if (!header++) print "data set", "configuration", commit[1]" records/s", commit[2]" records/s", "ratio"
+    printf "%s\t%s\t%s\t%.3f\n", key, old[key], $6, (old[key]>0?$6/old[key]:0)
+}
+$1=="micro" {
+    key=$2 OFS (++row[file, $2])
+    if (file==1) {line[key]=$0; next}
+    if (!(key in line)) next
+    split(line[key], before, "\t")
+    if (before[3]!=$3) next
+    out=$2 OFS $3
+    for (i=4; i<=NF; ++i) out=out OFS ((before[i]+0!=0 && $i ~ /^[0-9.e+-]+( |$)/)?sprintf("%.3f", $i/before[i]):"-")
+    micro[++n]=out
+}
+END {
+    if (n) print "\nmicro benchmark\trow\tratio of each column"
+    for (i=1; i<=n; ++i) print micro[i]
+}' "$1" "$2"
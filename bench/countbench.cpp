@@ -0,0 +1,191 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* microbenchmark of the per-read counting kernel on a synthetic high-depth locus:
+ * introns packed in a single gene cluster and reads piled up on top of them.
+ * The hash-map recorders and guided scan over intron pointers used before are kept here as the baseline,
+ * and the kernel is also run with identical alignments collapsed. */
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include "../count.h"
+#include "../parameter.h"
+
+struct Parameter *parameters;
+
+//the pointer-based intron the baseline works on
+struct Intron{
+    char* chrom;
+    uint32_t chromStart;
+    uint32_t chromEnd;
+    char strand;
+    uint32_t id;
+};
+bool compare(struct Intron* i, struct Intron* j){
+    return i->chromStart<j->chromStart;
+}
+int countIncHashed(int32_t chromStart, int32_t chromEnd, char strand, vector<struct Intron*>* index, int guide, unordered_map<struct Intron *,int>* incRecorder, unordered_map<struct Intron *,int>* cntRecorder){
+    int i=guide;
+    int32_t overlap, leftSpan, rightSpan;
+    while(i<(int)index->size() && (int32_t)(*index)[i]->chromEnd<=chromStart) ++i;
+    guide=i;
+    while(i<(int)index->size() && (int32_t)(*index)[i]->chromStart<chromEnd){
+        struct Intron* intron=(*index)[i];
+        if (strand == '.' || strand == intron->strand){
+            overlap=min((int32_t)intron->chromEnd, chromEnd)-max((int32_t)intron->chromStart, chromStart);
+            if (overlap>=parameters->span){
+                leftSpan=(int32_t)intron->chromStart-chromStart;
+                rightSpan=chromEnd-(int32_t)intron->chromEnd;
+                if (leftSpan>=parameters->span || rightSpan>=parameters->span) (*incRecorder)[intron]=1;
+                if (leftSpan<=0 && rightSpan<=0) (*cntRecorder)[intron]=1;
+            }
+        }
+        ++i;
+    }
+    return guide;
+}
+int countReadHashed(bam1_t *b, vector<struct Intron*>* incIndex, int guide, struct Counter *counter, unordered_map<struct Intron *,int>* incRecorder, unordered_map<struct Intron *,int>* cntRecorder){
+    incRecorder->clear();
+    cntRecorder->clear();
+    const uint32_t *cigar=getCigar(b);
+    const int cigarNum=getCigarNum(b);
+    int32_t chromStart=getPosition(b), chromEnd=chromStart, lastChromStart=0;
+    int i=0;
+    int subGuide=guide;
+    while(i<cigarNum){
+        while(i<cigarNum && getCigarOp(cigar[i])!=3){
+            if (getCigarType(cigar[i]) & 2u) chromEnd+=getCigarOplen(cigar[i]);
+            ++i;
+        }
+        subGuide=countIncHashed(chromStart, chromEnd, '.', incIndex, subGuide, incRecorder, cntRecorder);
+        if (lastChromStart==0) guide=subGuide;
+        if (i<cigarNum){
+            lastChromStart=chromStart;
+            chromStart=chromEnd+getCigarOplen(cigar[i]);
+            chromEnd=chromStart;
+            ++i;
+        }
+    }
+    for (auto intron:*incRecorder) counter->incCount[intron.first->id]++;
+    for (auto intron:*cntRecorder) counter->cntCount[intron.first->id]++;
+    return guide;
+}
+
+int main(int argc, char *argv[]){
+    int nIntrons=argc>1?atoi(argv[1]):2000;
+    int nReads=argc>2?atoi(argv[2]):2000000;
+    const int32_t locusLength=200000;
+    const int32_t readLength=100;
+    parameters=new struct Parameter();
+    parameters->span=6;
+    parameters->libraryType=FRUNSTRANDED;
+
+    mt19937 rng(20230101);
+    vector<struct Intron*> introns;
+    for (int i=0; i<nIntrons; ++i){
+        auto intron=new struct Intron;
+        intron->chrom=nullptr;
+        intron->chromStart=rng()%(locusLength-5000);
+        intron->chromEnd=intron->chromStart+80+rng()%4920;
+        intron->strand=rng()%2?'+':'-';
+        intron->id=i;
+        introns.push_back(intron);
+    }
+    auto incIndex=introns;
+    sort(incIndex.begin(), incIndex.end(), compare);
+    struct IntronSet intronSet;
+    vector<uint32_t> members;
+    for (auto i: introns){
+        intronSet.add("chr1", i->chromStart, i->chromEnd, i->strand);
+        members.push_back(i->id);
+    }
+    struct IntronIndex index;
+    index.build(intronSet, members);
+
+    //reads sorted by position, 70% of them spliced over one of the introns. The guided scan
+    //mistakes later segments for the first one when a read starts at 0, so reads start from 1
+    vector<pair<int32_t, struct Intron*>> placements;
+    for (int i=0; i<nReads; ++i){
+        auto intron=introns[rng()%introns.size()];
+        int32_t left=1+rng()%(readLength-1);
+        placements.push_back({max((int32_t)intron->chromStart-left, 1), rng()%10<7?intron:nullptr});
+    }
+    sort(placements.begin(), placements.end(), [](const pair<int32_t, struct Intron*> &i, const pair<int32_t, struct Intron*> &j){return i.first<j.first;});
+    vector<bam1_t*> reads;
+    for (auto &placement: placements){
+        auto b=bam_init1();
+        uint32_t cigar[3];
+        size_t nCigar=1;
+        int32_t left=placement.second?(int32_t)placement.second->chromStart-placement.first:0;
+        if (left>0){
+            cigar[0]=left<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+            cigar[1]=(placement.second->chromEnd-placement.second->chromStart)<<BAM_CIGAR_SHIFT|BAM_CREF_SKIP;
+            cigar[2]=(readLength-left)<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+            nCigar=3;
+        }
+        else cigar[0]=readLength<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+        bam_set1(b, 1, "r", 0, 0, placement.first, 60, nCigar, cigar, -1, -1, 0, 0, nullptr, nullptr, 0);
+        reads.push_back(b);
+    }
+
+    struct Counter hashed(introns.size()), stamped(introns.size()), collapsed(introns.size());
+    unordered_map<struct Intron *,int> incRecorder, cntRecorder;
+    int guide=0;
+    auto start=chrono::steady_clock::now();
+    for (auto b: reads) guide=countReadHashed(b, &incIndex, guide, &hashed, &incRecorder, &cntRecorder);
+    double hashedSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+    start=chrono::steady_clock::now();
+    for (auto b: reads) countRead<RuntimeLibrary>(b, &index, &stamped);
+    countSegments(&stamped);
+    double stampedSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+    start=chrono::steady_clock::now();
+    Collapser<RuntimeLibrary> collapser;
+    for (auto b: reads) collapser.add(b, &index, &collapsed);
+    collapser.flush(&collapsed);
+    double collapsedSeconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+    if (hashed.incCount!=stamped.incCount || hashed.cntCount!=stamped.cntCount){
+        cerr<<"[error] counts differ between the two recorders"<<endl;
+        return 1;
+    }
+    if (collapsed.incCount!=stamped.incCount || collapsed.cntCount!=stamped.cntCount || collapsed.skipCount!=stamped.skipCount){
+        cerr<<"[error] counts differ between collapsed and per-read counting"<<endl;
+        return 1;
+    }
+    cout<<"introns\t"<<nIntrons<<"\treads\t"<<nReads<<endl;
+    cout<<"hash-map recorder, guided scan\t"<<(uint64_t)(nReads/hashedSeconds)<<" reads/s"<<endl;
+    cout<<"current kernel\t"<<(uint64_t)(nReads/stampedSeconds)<<" reads/s"<<endl;
+    cout<<"speedup\t"<<hashedSeconds/stampedSeconds<<endl;
+    cout<<"current kernel, identical alignments collapsed\t"<<(uint64_t)(nReads/collapsedSeconds)<<" reads/s"<<endl;
+    for (auto b: reads) bam_destroy1(b);
+    for (auto i: introns) delete i;
+    return 0;
+}
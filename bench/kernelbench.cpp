@@ -0,0 +1,157 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* per-read cost of the counting kernel for each library type and paired setting, with unique alignments
+ * only so that the NH tag is looked up. The checks on the parameters and the NH lookup through
+ * bam_aux_get used before are the baseline for the kernels specialized on the library settings. */
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "../count.h"
+#include "../parameter.h"
+
+struct Parameter *parameters;
+
+//the per-read checks as they were, branching on the parameters for every read
+struct LegacyLibrary{
+    static const bool stats=false;
+    static bool proper(bam1_t *b){
+        if (parameters->isPaired && !isProperPair(b)) return false;
+        if (parameters->unique && getAuxInteger(b, "NH")!=1) return false;
+        return true;
+    }
+    static char strand(bam1_t *b){
+        return getStrand(b, parameters->isPaired, parameters->libraryType);
+    }
+};
+
+//best of a few runs, the first one also warms up the counters
+template<class L> double nanosecondsPerRead(const vector<bam1_t*> &reads, const struct IntronIndex &index, struct Counter *counter){
+    double best=0;
+    for (int run=0; run<3; ++run){
+        auto start=chrono::steady_clock::now();
+        for (auto b: reads) countRead<L>(b, &index, counter);
+        countSegments(counter);
+        double cost=chrono::duration<double, nano>(chrono::steady_clock::now()-start).count()/reads.size();
+        if (run==0 || cost<best) best=cost;
+    }
+    return best;
+}
+/* the checks alone, the strands are summed so that they are not optimized away. When counting, each record
+ * is checked right after it is decoded, so the checks run over a slice of records held in cache */
+template<class L> double nanosecondsPerCheck(const vector<bam1_t*> &reads, uint64_t *sum){
+    const size_t slice=min(reads.size(), (size_t)4096);
+    double best=0;
+    for (int run=0; run<3; ++run){
+        auto start=chrono::steady_clock::now();
+        for (size_t i=0; i<reads.size(); i+=slice)
+            for (size_t j=0; j<slice; ++j){
+                bam1_t *b=reads[j];
+                if (L::proper(b)) *sum+=L::strand(b);
+            }
+        double cost=chrono::duration<double, nano>(chrono::steady_clock::now()-start).count()/(reads.size()/slice*slice);
+        if (run==0 || cost<best) best=cost;
+    }
+    return best;
+}
+template<int libraryType, bool isPaired> void run(const char *name, const vector<bam1_t*> &reads, const struct IntronIndex &index, size_t n){
+    typedef Library<libraryType, isPaired, true> Specialized;
+    parameters->libraryType=libraryType;
+    parameters->isPaired=isPaired;
+    uint64_t legacySum=0, specializedSum=0;
+    double legacyCheck=nanosecondsPerCheck<LegacyLibrary>(reads, &legacySum);
+    double specializedCheck=nanosecondsPerCheck<Specialized>(reads, &specializedSum);
+    struct Counter legacy(n), specialized(n);
+    double legacyCost=nanosecondsPerRead<LegacyLibrary>(reads, index, &legacy);
+    double specializedCost=nanosecondsPerRead<Specialized>(reads, index, &specialized);
+    if (legacySum!=specializedSum || legacy.incCount!=specialized.incCount || legacy.cntCount!=specialized.cntCount || legacy.skipCount!=specialized.skipCount){
+        cerr<<"[error] results differ between the kernels for "<<name<<endl;
+        exit(1);
+    }
+    cout<<name<<(isPaired?" paired":" single")<<"\t"<<legacyCheck<<"\t"<<specializedCheck<<"\t"<<legacyCost<<"\t"<<specializedCost<<"\t"<<legacyCost/specializedCost<<endl;
+}
+
+int main(int argc, char *argv[]){
+    int nIntrons=argc>1?atoi(argv[1]):2000;
+    int nReads=argc>2?atoi(argv[2]):2000000;
+    const int32_t locusLength=200000;
+    const int32_t readLength=100;
+    parameters=new struct Parameter();
+    parameters->span=6;
+    parameters->unique=true;
+
+    mt19937 rng(20230101);
+    struct IntronSet introns;
+    vector<uint32_t> members;
+    for (int i=0; i<nIntrons; ++i){
+        int32_t start=rng()%(locusLength-5000);
+        introns.add("chr1", start, start+80+rng()%4920, rng()%2?'+':'-');
+        members.push_back(i);
+    }
+    struct IntronIndex index;
+    index.build(introns, members);
+
+    //properly paired reads with the flags of either mate, half of them spliced, NH among the usual tags of an aligner
+    vector<int32_t> positions;
+    for (int i=0; i<nReads; ++i) positions.push_back(rng()%(locusLength-readLength));
+    sort(positions.begin(), positions.end());
+    const uint16_t flags[]={99, 147, 83, 163};
+    vector<bam1_t*> reads;
+    for (auto position: positions){
+        auto b=bam_init1();
+        uint32_t cigar[3];
+        size_t nCigar=1;
+        if (rng()%2){
+            int32_t left=1+rng()%(readLength-1);
+            cigar[0]=left<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+            cigar[1]=(80+rng()%4920)<<BAM_CIGAR_SHIFT|BAM_CREF_SKIP;
+            cigar[2]=(readLength-left)<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+            nCigar=3;
+        }
+        else cigar[0]=readLength<<BAM_CIGAR_SHIFT|BAM_CMATCH;
+        bam_set1(b, 1, "r", flags[rng()%4], 0, position, 60, nCigar, cigar, 0, position, 0, 0, nullptr, nullptr, 32);
+        int32_t value=-10;
+        bam_aux_append(b, "AS", 'i', 4, (const uint8_t*)&value);
+        bam_aux_append(b, "XN", 'i', 4, (const uint8_t*)&value);
+        bam_aux_append(b, "MD", 'Z', 4, (const uint8_t*)"100");
+        bam_aux_append(b, "NM", 'C', 1, (const uint8_t*)"\0");
+        uint8_t hits=rng()%10?1:2;
+        bam_aux_append(b, "NH", 'C', 1, &hits);
+        reads.push_back(b);
+    }
+
+    cout<<"introns\t"<<nIntrons<<"\treads\t"<<nReads<<endl;
+    cout<<"ns/read\tbranching checks\tspecialized checks\tbranching kernel\tspecialized kernel\tspeedup"<<endl;
+    run<FRUNSTRANDED, false>("fr-unstranded", reads, index, introns.size());
+    run<FRUNSTRANDED, true>("fr-unstranded", reads, index, introns.size());
+    run<FRFIRSTSTRAND, false>("fr-firststrand", reads, index, introns.size());
+    run<FRFIRSTSTRAND, true>("fr-firststrand", reads, index, introns.size());
+    run<FRSECONDSTRAND, false>("fr-secondstrand", reads, index, introns.size());
+    run<FRSECONDSTRAND, true>("fr-secondstrand", reads, index, introns.size());
+    for (auto b: reads) bam_destroy1(b);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* overlap query benchmark on a GENCODE-scale synthetic annotation: genes with log-normal spans
+ * (some over 1 Mb), alternative exons giving nested introns, and sorted 100 bp reads drawn from
+ * the gene bodies, genome-wide and packed in a gene-dense region. The guided linear scan used before the interval tree is kept as the baseline. */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include "../count.h"
+
+//the pointer-based intron the baseline works on
+struct Intron{
+    char* chrom;
+    uint32_t chromStart;
+    uint32_t chromEnd;
+    char strand;
+    uint32_t id;
+};
+bool compare(struct Intron* i, struct Intron* j){
+    return i->chromStart<j->chromStart;
+}
+//the guided scan over introns sorted by start, as countInc did before the interval tree
+int scanOverlaps(int32_t start, int32_t end, vector<struct Intron*>* index, int guide, uint64_t *hits, uint64_t *tested){
+    int i=guide;
+    while(i<(int)index->size() && (int32_t)(*index)[i]->chromEnd<=start) ++i;
+    guide=i;
+    while(i<(int)index->size() && (int32_t)(*index)[i]->chromStart<end){
+        ++*tested;
+        if ((int32_t)(*index)[i]->chromEnd>start) ++*hits;
+        ++i;
+    }
+    return guide;
+}
+
+void runScenario(const char *name, int nChroms, int32_t chromLength, int nGenes, int nReads){
+    const int32_t readLength=100;
+    mt19937 rng(20230101);
+    lognormal_distribution<double> geneSpan(log(25000.0), 1.4);
+
+    double scanSeconds=0, treeSeconds=0;
+    uint64_t nIntrons=0, scanHits=0, treeHits=0, scanTested=0, nSegments=0;
+    for (int c=0; c<nChroms; ++c){
+        vector<struct Intron*> introns;
+        vector<pair<int32_t, int32_t>> exons;
+        for (int g=0; g<nGenes; ++g){
+            int32_t span=min((int32_t)geneSpan(rng)+1000, min(2000000, chromLength/2));
+            int32_t geneStart=rng()%(chromLength-span);
+            int nExons=2+rng()%15;
+            vector<int32_t> bounds;
+            for (int e=0; e<2*nExons; ++e) bounds.push_back(geneStart+rng()%span);
+            sort(bounds.begin(), bounds.end());
+            bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+            if (bounds.size()%2) bounds.pop_back();
+            for (size_t e=0; e+1<bounds.size(); e+=2) exons.push_back({bounds[e], bounds[e+1]});
+            //introns between consecutive exons and, for alternative exons, skipping one or two of them
+            for (size_t e=1; e+2<bounds.size(); e+=2){
+                for (size_t skip=0; skip<3 && e+2*skip+1<bounds.size(); ++skip){
+                    if (skip>0 && rng()%3) continue;
+                    auto intron=new struct Intron;
+                    intron->chrom=nullptr;
+                    intron->chromStart=bounds[e];
+                    intron->chromEnd=bounds[e+2*skip+1];
+                    intron->strand='+';
+                    intron->id=introns.size();
+                    introns.push_back(intron);
+                }
+            }
+        }
+        nIntrons+=introns.size();
+        vector<pair<int32_t, int32_t>> segments;
+        for (int r=0; r<nReads; ++r){
+            auto &exon=exons[rng()%exons.size()];
+            int32_t start=exon.first+rng()%(exon.second-exon.first+1);
+            segments.push_back({start, start+readLength});
+        }
+        sort(segments.begin(), segments.end());
+        nSegments+=segments.size();
+
+        auto sorted=introns;
+        sort(sorted.begin(), sorted.end(), compare);
+        int guide=0;
+        auto start=chrono::steady_clock::now();
+        for (auto &segment: segments) guide=scanOverlaps(segment.first, segment.second, &sorted, guide, &scanHits, &scanTested);
+        scanSeconds+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+        struct IntronSet intronSet;
+        vector<uint32_t> members;
+        for (auto i: introns){
+            intronSet.add("chr1", i->chromStart, i->chromEnd, i->strand);
+            members.push_back(i->id);
+        }
+        struct IntronIndex index;
+        index.build(intronSet, members);
+        start=chrono::steady_clock::now();
+        for (auto &segment: segments) index.overlap(segment.first, segment.second, [&](int32_t){++treeHits;});
+        treeSeconds+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        for (auto i: introns) delete i;
+    }
+    if (scanHits!=treeHits){
+        cerr<<"[error] overlaps differ between the scan and the interval tree"<<endl;
+        exit(1);
+    }
+    cout<<name<<"\tintrons\t"<<nIntrons<<"\tsegments\t"<<nSegments<<"\toverlaps per segment\t"<<(double)treeHits/nSegments<<endl;
+    cout<<name<<"\tguided scan\t"<<(uint64_t)(nSegments/scanSeconds)<<" segments/s\t"<<(double)scanTested/nSegments<<" introns tested per segment"<<endl;
+    cout<<name<<"\tinterval tree\t"<<(uint64_t)(nSegments/treeSeconds)<<" segments/s"<<endl;
+    cout<<name<<"\tspeedup\t"<<scanSeconds/treeSeconds<<endl;
+}
+
+int main(int argc, char *argv[]){
+    int nChroms=argc>1?atoi(argv[1]):20;
+    int nReads=argc>2?atoi(argv[2]):500000; //reads per chromosome
+    //genes spread over chromosomes of 150 Mb, about 700k introns in total
+    runScenario("genome", nChroms, 150000000, 3000, nReads);
+    //the same genes packed into a 10 Mb gene-dense region, where long introns cover many short ones
+    runScenario("cluster", 1, 10000000, 3000, nReads);
+    return 0;
+}
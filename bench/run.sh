@@ -0,0 +1,110 @@
+#!/bin/bash
+# Benchmark report of a build: the micro benchmarks, then iucount on synthetic data sets written by
+# benchdata, best of REPEAT runs each. Lines are tab separated and start with the kind of measure, the
+# reports of two commits are compared with bench/compare.sh. The speedup lines at the end give the gain of the
+# threaded runs over the single threaded ones, measured in the same report.
+#   bench/run.sh <build directory> [report file]
+# QUICK=1 runs smaller data sets and micro benchmarks, THREADS sets the threads of the threaded runs.
+set -e
+BUILD=$(cd "${1:?usage: run.sh <build directory> [report file]}" && pwd)
+SOURCE=$(cd "$(dirname "$0")/.." && pwd)
+REPORT=${2:-$BUILD/bench-$(git -C "$SOURCE" rev-parse --short HEAD 2>/dev/null || echo unknown).tsv}
+REPEAT=${REPEAT:-3}
+THREADS=${THREADS:-4}
+DATA=$BUILD/bench-data
+mkdir -p "$DATA"
+
+SCALE=1
+[ -n "$QUICK" ] && SCALE=10
+# name, then the options of benchdata
+DATASETS="single:-g $((2000/SCALE)) -d 20
+paired:-g $((2000/SCALE)) -d 20 -p -t fr-firststrand
+deep:-g $((100/SCALE+1)) -d $((2000/SCALE))
+nested:-g $((2000/SCALE)) -d 20 -n 0.5 -I 5000 -z 1.5
+namesorted:-g $((2000/SCALE)) -d 20 -p -t fr-firststrand -O name"
+# name, then the options of iucount. Paired runs only on paired data sets, name sorted data is counted
+# with --unsorted, or sorted with samtools first if it is found, against the same reads sorted in paired
+CONFIGS="default:
+unique:-u
+stream:-S
+stream-threads:-S -@ $THREADS
+threads:-@ $THREADS
+paired:-p -t fr-firststrand
+fragment:-p -t fr-firststrand -f
+unsorted:--unsorted
+unsorted-fragment:-p -t fr-firststrand -f --unsorted
+sort-then-count:
+sort-then-count-fragment:-p -t fr-firststrand -f"
+
+{
+    echo -e "#commit\t$(git -C "$SOURCE" rev-parse HEAD 2>/dev/null || echo unknown)"
+    echo -e "#date\t$(date -u +%Y-%m-%dT%H:%M:%SZ)"
+    echo -e "#host\t$(uname -srm)\t$(nproc) cpus"
+} > "$REPORT"
+
+# micro benchmarks, their lines prefixed with the benchmark name
+for bench in "countbench:200 100000" "overlapbench:2 100000" "kernelbench:200 100000" "segmentbench:300 100000"; do
+    quick=${bench#*:}
+    bench=${bench%%:*}
+    [ -x "$BUILD/$bench" ] || continue
+    echo "running $bench" >&2
+    "$BUILD/$bench" ${QUICK:+$quick} | sed "s/^/micro\t$bench\t/" >> "$REPORT"
+done
+
+echo -e "#end2end\tdata set\tconfiguration\trecords\tseconds\trecords/s\tpeak rss KB" >> "$REPORT"
+while IFS=: read -r name options; do
+    # the data only depends on the options, so it is kept between runs
+    if [ ! -f "$DATA/$name.bam" ] || [ "$(cat "$DATA/$name.options" 2>/dev/null)" != "$options" ]; then
+        echo "generating $name" >&2
+        "$BUILD/benchdata" -o "$DATA/$name" $options
+        echo "$options" > "$DATA/$name.options"
+    fi
+    while IFS=: read -r config arguments; do
+        case "$config" in *paired|*fragment) [[ "$options" == *-p* ]] || continue;; esac
+        case "$config" in
+            unsorted*|sort-then-count*) [[ "$options" == *"-O name"* ]] || continue;;
+            *) [[ "$options" == *"-O name"* ]] && continue;;
+        esac
+        bam=$DATA/$name.bam
+        sortSeconds=0
+        if [[ "$config" == sort-then-count* ]]; then
+            command -v samtools >/dev/null || continue
+            start=$(date +%s.%N)
+            samtools sort -@ "$THREADS" -o "$DATA/sorted.bam" "$bam" 2>/dev/null
+            samtools index "$DATA/sorted.bam"
+            sortSeconds=$(awk "BEGIN{print $(date +%s.%N)-$start}")
+            bam=$DATA/sorted.bam
+        fi
+        echo "running $name $config" >&2
+        # timed without --stats, from the summary line of iucount, and once more with it for the peak memory
+        best=""
+        for ((i=0; i<REPEAT; ++i)); do
+            "$BUILD/iucount" -i "$DATA/$name.introns.txt" -b "$bam" $arguments -o "$DATA/counts.txt" 2>"$DATA/log.txt" </dev/null
+            summary=$(grep '^processed' "$DATA/log.txt")
+            seconds=$(echo "$summary" | sed 's/.* in \([^ ]*\) seconds.*/\1/')
+            seconds=$(awk "BEGIN{print $seconds+$sortSeconds}")
+            if [ -z "$best" ] || awk "BEGIN{exit !($seconds<$best)}"; then
+                best=$seconds
+                records=$(echo "$summary" | cut -d' ' -f2)
+            fi
+        done
+        "$BUILD/iucount" -i "$DATA/$name.introns.txt" -b "$bam" $arguments --stats "$DATA/stats.json" -o "$DATA/counts.txt" 2>/dev/null </dev/null
+        rss=$(grep -o '"peakRssKB": [0-9]*' "$DATA/stats.json" | cut -d' ' -f2)
+        echo -e "end2end\t$name\t$config\t$records\t$best\t$(awk "BEGIN{printf \"%d\", $records/($best>0?$best:1e-9)}")\t$rss" >> "$REPORT"
+    done <<< "$CONFIGS"
+done <<< "$DATASETS"
+# the gain of the threaded runs over the single threaded ones of the same data set in this report: -@ decompressing
+# a single stream, and counting the chromosomes of an indexed bam file in parallel
+echo -e "#speedup\tdata set\tconfiguration\tbaseline\tthreads\tspeedup" >> "$REPORT"
+awk -F'\t' -v threads="$THREADS" '
+BEGIN {pairs["stream-threads"]="stream"; pairs["threads"]="default"}
+$1=="end2end" {rate[$2"\t"$3]=$6; sets[$2]=1}
+END {
+    for (name in sets) for (config in pairs) {
+        baseline=name"\t"pairs[config]
+        if ((name"\t"config) in rate && rate[baseline]>0)
+            printf "speedup\t%s\t%s\t%s\t%d\t%.2f\n", name, config, pairs[config], threads, rate[name"\t"config]/rate[baseline]
+    }
+}' "$REPORT" | sort >> "$REPORT"
+rm -f "$DATA/stats.json" "$DATA/counts.txt" "$DATA/log.txt" "$DATA/sorted.bam" "$DATA/sorted.bam.bai"
+echo "report written to $REPORT" >&2
@@ -0,0 +1,161 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* per-segment cost of the inc and cnt tests on a gene-dense region, where long introns of alternative
+ * isoforms cover many short ones and the leaves of the interval tree are mostly overlapped. The test
+ * of one intron at a time used before is the baseline for the scalar and vector range tests. */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include "../count.h"
+#include "../parameter.h"
+
+struct Parameter *parameters;
+
+//the per-intron test countInc did before the range tests
+void countIncEach(int32_t chromStart, int32_t chromEnd, char strand, const struct IntronIndex* index, struct Counter *counter){
+    index->overlap(chromStart, chromEnd, [&](int32_t i){
+        int32_t overlap, leftSpan, rightSpan;
+        if (strand == '.' || strand == index->strands[i]){
+            overlap=min(index->ends[i], chromEnd)-max(index->starts[i], chromStart);
+            if (overlap>=parameters->span){
+                uint32_t id=index->ids[i];
+                leftSpan=index->starts[i]-chromStart;
+                rightSpan=chromEnd-index->ends[i];
+                if ((leftSpan>=parameters->span || rightSpan>=parameters->span) && counter->incStamp[id]!=counter->readId){
+                    counter->incStamp[id]=counter->readId;
+                    counter->incCount[id]++;
+                }
+                if (leftSpan<=0 && rightSpan<=0 && counter->cntStamp[id]!=counter->readId){
+                    counter->cntStamp[id]=counter->readId;
+                    counter->cntCount[id]++;
+                }
+            }
+        }
+    });
+}
+struct Segment{
+    int32_t start;
+    int32_t end;
+    char strand;
+};
+template<typename F> double secondsFor(const vector<struct Segment> &segments, struct Counter *counter, F count){
+    double best=0;
+    for (int run=0; run<5; ++run){
+        fill(counter->incCount.begin(), counter->incCount.end(), 0);
+        fill(counter->cntCount.begin(), counter->cntCount.end(), 0);
+        auto start=chrono::steady_clock::now();
+        for (auto &segment: segments){
+            counter->readId++;
+            count(segment);
+        }
+        double seconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        if (run==0 || seconds<best) best=seconds;
+    }
+    return best;
+}
+
+int main(int argc, char *argv[]){
+    int nGenes=argc>1?atoi(argv[1]):3000;
+    int nReads=argc>2?atoi(argv[2]):1000000;
+    const int32_t regionLength=10000000;
+    const int32_t readLength=100;
+    parameters=new struct Parameter();
+    parameters->span=6;
+
+    //genes packed in a 10 Mb region with alternative exons, as in overlapbench
+    mt19937 rng(20230101);
+    lognormal_distribution<double> geneSpan(log(25000.0), 1.4);
+    struct IntronSet introns;
+    vector<pair<int32_t, int32_t>> exons;
+    for (int g=0; g<nGenes; ++g){
+        int32_t span=min((int32_t)geneSpan(rng)+1000, regionLength/2);
+        int32_t geneStart=rng()%(regionLength-span);
+        char strand=rng()%2?'+':'-';
+        int nExons=2+rng()%15;
+        vector<int32_t> bounds;
+        for (int e=0; e<2*nExons; ++e) bounds.push_back(geneStart+rng()%span);
+        sort(bounds.begin(), bounds.end());
+        bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+        if (bounds.size()%2) bounds.pop_back();
+        for (size_t e=0; e+1<bounds.size(); e+=2) exons.push_back({bounds[e], bounds[e+1]});
+        for (size_t e=1; e+2<bounds.size(); e+=2)
+            for (size_t skip=0; skip<3 && e+2*skip+1<bounds.size(); ++skip)
+                if (skip==0 || rng()%3==0) introns.add("chr1", bounds[e], bounds[e+2*skip+1], strand);
+    }
+    vector<uint32_t> members;
+    for (uint32_t i=0; i<introns.size(); ++i) members.push_back(i);
+    struct IntronIndex index;
+    index.build(introns, members);
+    vector<struct Segment> segments;
+    for (int r=0; r<nReads; ++r){
+        auto &exon=exons[rng()%exons.size()];
+        int32_t start=exon.first+rng()%(exon.second-exon.first+1);
+        segments.push_back({start, start+readLength, "+-."[rng()%3]});
+    }
+    sort(segments.begin(), segments.end(), [](const struct Segment &i, const struct Segment &j){return i.start<j.start;});
+
+    //the tests alone, counting the introns found, and the whole of countInc with the stamps and counts
+    struct Counter each(introns.size()), tested(introns.size());
+    uint64_t eachFound=0;
+    double eachTestSeconds=secondsFor(segments, &each, [&](const struct Segment &s){
+        index.overlap(s.start, s.end, [&](int32_t i){
+            if ((s.strand=='.' || s.strand==index.strands[i]) && min(index.ends[i], s.end)-max(index.starts[i], s.start)>=parameters->span) eachFound++;
+        });
+    });
+    double eachSeconds=secondsFor(segments, &each, [&](const struct Segment &s){countIncEach(s.start, s.end, s.strand, &index, &each);});
+    cout<<"introns\t"<<introns.size()<<"\tsegments\t"<<segments.size()<<endl;
+    cout<<"segments/s\ttests\tspeedup\tcountInc\tspeedup"<<endl;
+    cout<<"one intron at a time\t"<<(uint64_t)(segments.size()/eachTestSeconds)<<"\t1\t"<<(uint64_t)(segments.size()/eachSeconds)<<"\t1"<<endl;
+    vector<pair<const char*, IntronTest>> tests={{"scalar range test", testIntronsScalar}};
+    auto selected=testIntrons;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) tests.push_back({"sse4.1 range test", testIntronsSse4});
+    if (__builtin_cpu_supports("avx2")) tests.push_back({"avx2 range test", testIntronsAvx2});
+#endif
+    for (auto &test: tests){
+        testIntrons=test.second;
+        uint64_t found=0;
+        double testSeconds=secondsFor(segments, &tested, [&](const struct Segment &s){
+            index.overlapRanges(s.start, s.end, [&](int32_t i0, int32_t i1){
+                uint64_t inc, cnt;
+                testIntrons(index.starts+i0, index.ends+i0, index.strands+i0, i1-i0, s.start, s.end, s.strand, parameters->span, &inc, &cnt);
+                found+=__builtin_popcountll(inc|cnt);
+            });
+        });
+        double seconds=secondsFor(segments, &tested, [&](const struct Segment &s){countInc(s.start, s.end, s.strand, 1, &index, &tested);});
+        //the introns overlapped but neither spanned nor covered are found by the per-intron test only
+        if (found>eachFound || tested.incCount!=each.incCount || tested.cntCount!=each.cntCount){
+            cerr<<"[error] results differ for the "<<test.first<<endl;
+            return 1;
+        }
+        cout<<test.first<<(test.second==selected?" (selected)":"")<<"\t"<<(uint64_t)(segments.size()/testSeconds)<<"\t"<<eachTestSeconds/testSeconds<<"\t"<<(uint64_t)(segments.size()/seconds)<<"\t"<<eachSeconds/seconds<<endl;
+    }
+    return 0;
+}
@@ -0,0 +1,166 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_CHECKPOINT_H
+#define IUCOUNT_CHECKPOINT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "count.h"
+using namespace std;
+
+/* the counts of one chromosome of a sample, saved once the chromosome is counted so that a later run
+ * restores them instead of counting it again. The introns are those of the chromosome in the order of
+ * its index, the checkpoint is only restored with the same introns and counting settings. A run that
+ * still counts some chromosomes of the sample also needs the same bam file left unchanged, a run
+ * restoring every chromosome merges the checkpoints without the bam file:
+ *   header
+ *   inc, cnt and skip counts of the introns as int32 */
+#define CHECKPOINT_MAGIC "IUCCKP\1\0"
+#define CHECKPOINT_VERSION 2u
+//the bam file the counts come from, by its absolute path, size and modification time
+struct CheckpointInput{
+    uint64_t path; //hash of the path
+    uint64_t size;
+    int64_t mtime; //in nanoseconds
+};
+struct CheckpointHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t settings; //hash of the settings the counts depend on
+    uint64_t introns; //hash of the introns of the chromosome
+    struct CheckpointInput input;
+    uint64_t n;
+};
+//the file of a chromosome of a sample, slashes in names would be directories
+inline string checkpointName(const string &dir, const string &sample, const string &chrom){
+    string name=sample+'.'+chrom;
+    for (auto &c: name) if (c=='/') c='_';
+    return dir+'/'+name+".iuc";
+}
+inline bool checkpointInput(const char *bamFile, struct CheckpointInput *input){
+    struct stat st;
+    char *path=realpath(bamFile, nullptr);
+    if (!path || stat(path, &st)!=0){
+        free(path);
+        return false;
+    }
+    input->path=0xcbf29ce484222325ull;
+    for (const char *c=path; *c; ++c) input->path=(input->path^(uint8_t)*c)*0x100000001b3ull;
+    free(path);
+    input->size=st.st_size;
+    input->mtime=(int64_t)st.st_mtim.tv_sec*1000000000+st.st_mtim.tv_nsec;
+    return true;
+}
+inline uint64_t hashIntrons(const struct IntronIndex &index){
+    uint64_t h=0xcbf29ce484222325ull;
+    auto mix=[&](uint64_t value){h=(h^value)*0x100000001b3ull;};
+    mix(index.n);
+    for (int32_t i=0; i<index.n; ++i){
+        mix((uint64_t)(uint32_t)index.starts[i]<<32|(uint32_t)index.ends[i]);
+        mix((uint8_t)index.strands[i]);
+    }
+    return h;
+}
+//written to a temporary file renamed once complete, so that a run stopped while writing leaves no partial checkpoint
+inline bool writeCheckpoint(const string &fn, uint64_t settings, const struct CheckpointInput &input, const struct IntronIndex &index, const struct Counter &counter){
+    struct CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, 8);
+    header.version=CHECKPOINT_VERSION;
+    header.byteOrder=INTRON_INDEX_BYTE_ORDER;
+    header.settings=settings;
+    header.introns=hashIntrons(index);
+    header.input=input;
+    header.n=index.n;
+    vector<int32_t> counts(3*(size_t)index.n);
+    for (int32_t i=0; i<index.n; ++i){
+        uint32_t id=index.ids[i];
+        counts[i]=counter.incCount[id];
+        counts[index.n+i]=counter.cntCount[id];
+        counts[2*(size_t)index.n+i]=counter.skipCount[id];
+    }
+    string tmp=fn+".tmp";
+    FILE *fp=fopen(tmp.c_str(), "wb");
+    if (!fp) return false;
+    bool written=fwrite(&header, sizeof(header), 1, fp)==1 && fwrite(counts.data(), sizeof(int32_t), counts.size(), fp)==counts.size();
+    written&=fflush(fp)==0 && fsync(fileno(fp))==0;
+    written&=fclose(fp)==0;
+    if (!written || rename(tmp.c_str(), fn.c_str())!=0){
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+/* add the counts of a checkpoint to those of the counter, and give the bam file they come from. Returns 1
+ * if restored, 0 if there is no checkpoint, and -1 if it does not match the introns and settings or can
+ * not be read */
+inline int readCheckpoint(const string &fn, uint64_t settings, const struct IntronIndex &index, struct Counter *counter, struct CheckpointInput *input){
+    FILE *fp=fopen(fn.c_str(), "rb");
+    if (!fp) return 0;
+    struct CheckpointHeader header;
+    vector<int32_t> counts(3*(size_t)index.n);
+    bool valid=fread(&header, sizeof(header), 1, fp)==1 && memcmp(header.magic, CHECKPOINT_MAGIC, 8)==0 &&
+               header.version==CHECKPOINT_VERSION && header.byteOrder==INTRON_INDEX_BYTE_ORDER;
+    if (!valid) cerr<<"[error] "<<fn<<" is not a checkpoint of this version"<<endl;
+    else if (header.settings!=settings || header.introns!=hashIntrons(index) || header.n!=(uint64_t)index.n){
+        cerr<<"[error] checkpoint "<<fn<<" was written with other introns or settings"<<endl;
+        valid=false;
+    }
+    else if (fread(counts.data(), sizeof(int32_t), counts.size(), fp)!=counts.size()){
+        cerr<<"[error] failed to read checkpoint "<<fn<<endl;
+        valid=false;
+    }
+    fclose(fp);
+    if (!valid) return -1;
+    *input=header.input;
+    for (int32_t i=0; i<index.n; ++i){
+        uint32_t id=index.ids[i];
+        counter->incCount[id]+=counts[i];
+        counter->cntCount[id]+=counts[index.n+i];
+        counter->skipCount[id]+=counts[2*(size_t)index.n+i];
+    }
+    return 1;
+}
+//whether a checkpoint was written from the bam file, counted along with the chromosomes not restored
+inline bool sameInput(const string &fn, const struct CheckpointInput &written, const struct CheckpointInput &input){
+    if (written.path!=input.path){
+        cerr<<"[error] checkpoint "<<fn<<" was written from another bam file"<<endl;
+        return false;
+    }
+    if (written.size!=input.size || written.mtime!=input.mtime){
+        cerr<<"[error] the bam file has changed since checkpoint "<<fn<<" was written"<<endl;
+        return false;
+    }
+    return true;
+}
+#endif
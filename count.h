@@ -0,0 +1,701 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_COUNT_H
+#define IUCOUNT_COUNT_H
+
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <queue>
+#include <list>
+#include <array>
+#include <unordered_set>
+#include "overlap.h"
+#include "intron.h"
+#include "bam.h"
+#include "utility.h"
+using namespace std;
+
+/* the settings the counting of a counter depends on, besides those of its library. Every counter holds
+ * its own, so that counters of different settings can count side by side */
+struct CountSettings{
+    int span=6;
+    size_t mateBuffer=1000000;
+    const char *barcodeTag=nullptr;
+    const char *umiTag=nullptr;
+};
+//what counting went through, gathered with --stats only, per chromosome and summed over the workers
+struct Stats{
+    uint64_t records=0; //records of the chromosome read
+    uint64_t filtered=0; //records failing the paired or unique checks
+    uint64_t spliced=0; //records kept with a skipped region
+    uint64_t tested=0; //introns tested against the segments
+    uint64_t junctionLookups=0;
+    uint64_t junctionHits=0;
+    double decodeSeconds=0;
+    double countSeconds=0;
+    void add(const struct Stats &stats){
+        records+=stats.records;
+        filtered+=stats.filtered;
+        spliced+=stats.spliced;
+        tested+=stats.tested;
+        junctionLookups+=stats.junctionLookups;
+        junctionHits+=stats.junctionHits;
+        decodeSeconds+=stats.decodeSeconds;
+        countSeconds+=stats.countSeconds;
+    }
+};
+/* where a record comes from, kept with its alignment until it is counted: its cell and umi in barcode mode,
+ * and with --junctions its chromosome and the strand of its junctions given by the aligner, if any */
+struct Origin{
+    uint32_t cell=0;
+    int32_t chromId=-1;
+    uint64_t umi=0;
+    char strand=0;
+};
+/* --junctions: every junction read on a chromosome, annotated or not, with the number of reads and the
+ * shortest anchor of its reads, the shorter of the segments on either side. The last read counted keeps
+ * the mates of a fragment from counting twice. Open addressing with linear probing, an entry is 24 bytes */
+struct JunctionTable{
+    struct Entry{
+        uint64_t key; //start<<32|end
+        uint64_t readId;
+        uint32_t reads;
+        uint16_t anchor;
+        char strand;
+    };
+    static constexpr uint64_t emptyKey=UINT64_MAX;
+    vector<struct Entry> entries;
+    size_t used=0;
+    static size_t slot(uint64_t key, char strand, uint64_t mask){
+        return ((key^(uint64_t)(uint8_t)strand)*0x9E3779B97F4A7C15ull>>32)&mask;
+    }
+    struct Entry* find(uint64_t key, char strand){
+        if (2*(used+1)>entries.size()) grow();
+        uint64_t mask=entries.size()-1;
+        for (size_t i=slot(key, strand, mask);; i=(i+1)&mask){
+            auto &entry=entries[i];
+            if (entry.key==emptyKey){
+                entry={key, UINT64_MAX, 0, UINT16_MAX, strand};
+                ++used;
+                return &entry;
+            }
+            if (entry.key==key && entry.strand==strand) return &entry;
+        }
+    }
+    void grow(){
+        vector<struct Entry> old;
+        old.swap(entries);
+        entries.assign(max(old.size()*2, (size_t)1024), {emptyKey, 0, 0, 0, 0});
+        used=0;
+        for (auto &entry: old) if (entry.key!=emptyKey) *find(entry.key, entry.strand)=entry;
+    }
+    void add(int32_t start, int32_t end, char strand, int32_t anchor, int weight, uint64_t readId){
+        auto entry=find((uint64_t)start<<32|(uint32_t)end, strand);
+        if (entry->readId==readId) return;
+        entry->readId=readId;
+        entry->reads+=weight;
+        entry->anchor=min((int32_t)entry->anchor, anchor);
+    }
+    void merge(const struct JunctionTable &other){
+        for (auto &entry: other.entries){
+            if (entry.key==emptyKey) continue;
+            auto to=find(entry.key, entry.strand);
+            to->reads+=entry.reads;
+            to->anchor=min(to->anchor, entry.anchor);
+        }
+    }
+    void clear(){
+        vector<struct Entry>().swap(entries);
+        used=0;
+    }
+    //the junctions sorted by start, end and strand, emptying the table
+    vector<struct Entry> take(){
+        vector<struct Entry> taken;
+        taken.reserve(used);
+        for (auto &entry: entries) if (entry.key!=emptyKey) taken.push_back(entry);
+        clear();
+        sort(taken.begin(), taken.end(), [](const struct Entry &i, const struct Entry &j){
+            return i.key<j.key || (i.key==j.key && i.strand<j.strand);
+        });
+        return taken;
+    }
+};
+//the junction tables of the chromosomes of a bam file, those of a chromosome are taken once it is counted
+struct Junctions{
+    vector<struct JunctionTable> tables;
+    explicit Junctions(size_t n): tables(n){}
+};
+/* barcode mode: the counts of each intron in each cell, held only for the introns a cell has reads on.
+ * Cells are numbered by a worker in the order they come. With umis, the distinct umis of an intron and
+ * cell are kept for each kind of count instead, and counted once the workers are merged */
+struct CellCounts{
+    enum {inc, cnt, skip};
+    unordered_map<string, uint32_t> ids;
+    vector<string> barcodes;
+    uint32_t lastId=0; //records of a cell often come together
+    unordered_map<uint64_t, array<int, 3>> counts; //by intron id<<32|cell
+    struct Umi{
+        uint64_t entry; //intron id<<32|cell
+        uint64_t umi; //hash of the umi<<2|kind
+        bool operator==(const struct Umi &other) const{return entry==other.entry && umi==other.umi;}
+    };
+    struct UmiHash{
+        size_t operator()(const struct Umi &key) const{return key.entry*0x9E3779B97F4A7C15ull^key.umi;}
+    };
+    unordered_set<struct Umi, UmiHash> umis;
+    bool umi; //whether the umis are counted
+    explicit CellCounts(bool umi): umi(umi){}
+    static uint64_t hash(const char *s){
+        uint64_t h=0xcbf29ce484222325ull;
+        for (; *s; ++s) h=(h^(uint8_t)*s)*0x100000001b3ull;
+        return h;
+    }
+    uint32_t cell(const char *barcode){
+        if (!barcodes.empty() && barcodes[lastId]==barcode) return lastId;
+        auto inserted=ids.emplace(barcode, barcodes.size());
+        if (inserted.second) barcodes.push_back(barcode);
+        return lastId=inserted.first->second;
+    }
+    void add(uint32_t id, int kind, int weight, const struct Origin &origin){
+        uint64_t entry=(uint64_t)id<<32|origin.cell;
+        if (umi) umis.insert({entry, origin.umi<<2|kind});
+        else counts[entry][kind]+=weight;
+    }
+    void merge(const struct CellCounts &other){
+        vector<uint32_t> cells(other.barcodes.size());
+        for (size_t i=0; i<cells.size(); ++i) cells[i]=cell(other.barcodes[i].c_str());
+        for (auto &count: other.counts){
+            auto &to=counts[(count.first & ~0xFFFFFFFFull)|cells[(uint32_t)count.first]];
+            for (int kind=0; kind<3; ++kind) to[kind]+=count.second[kind];
+        }
+        for (auto &umi: other.umis) umis.insert({(umi.entry & ~0xFFFFFFFFull)|cells[(uint32_t)umi.entry], umi.umi});
+    }
+    //the umis of the merged workers into counts
+    void countUmis(){
+        for (auto &umi: umis) counts[umi.entry][umi.umi&3]++;
+        decltype(umis)().swap(umis);
+    }
+};
+//counts of one worker, indexed by intron id, the workers of a sample are merged after counting
+struct Counter{
+    vector<int> incCount;
+    vector<int> cntCount;
+    vector<int> skipCount;
+    //the last read counted for each intron, so that a read overlapping an intron with several segments counts once
+    vector<uint64_t> incStamp;
+    vector<uint64_t> cntStamp;
+    vector<uint64_t> skipStamp;
+    uint64_t readId=0;
+    uint64_t readCount=0;
+    //fragment mode: the most mates waiting for their pair at once, their approximate size, and mates counted alone for lack of room
+    uint64_t matePeak=0;
+    uint64_t mateBytesPeak=0;
+    uint64_t mateOverflow=0;
+    //segments of a block of reads, gathered before they are tested against the introns together
+    struct Segment{
+        int32_t start;
+        int32_t end;
+        char strand;
+        int weight;
+        uint64_t readId;
+        struct Origin origin;
+    };
+    static const size_t batchSize=256;
+    vector<struct Segment> segments;
+    const struct IntronIndex* segmentIndex=nullptr;
+    //the statistics of the chromosome being counted, added to those of the chromosome id once it is done
+    struct Stats stats;
+    vector<struct Stats> chromStats;
+    vector<string> chromNames;
+    struct CountSettings settings;
+    //barcode mode only
+    struct CellCounts *cells=nullptr;
+    //--junctions only, set up once the chromosomes of the bam file are known
+    struct Junctions *junctions=nullptr;
+    struct Origin origin;
+    explicit Counter(size_t n, const struct CountSettings &settings=CountSettings()): incCount(n), cntCount(n), skipCount(n), incStamp(n), cntStamp(n), skipStamp(n), settings(settings){
+        if (settings.barcodeTag) cells=new struct CellCounts(settings.umiTag!=nullptr);
+    }
+    ~Counter(){
+        delete cells;
+        delete junctions;
+    }
+    //the counts of the given introns, those of a chromosome are merged once all its tasks are done
+    void mergeIntrons(const struct Counter &counter, const uint32_t *ids, size_t n){
+        for (size_t i=0; i<n; ++i){
+            uint32_t id=ids[i];
+            incCount[id]+=counter.incCount[id];
+            cntCount[id]+=counter.cntCount[id];
+            skipCount[id]+=counter.skipCount[id];
+        }
+    }
+    //everything but the counts of the introns
+    void mergeTotals(const struct Counter &counter){
+        readCount+=counter.readCount;
+        matePeak=max(matePeak, counter.matePeak);
+        mateBytesPeak=max(mateBytesPeak, counter.mateBytesPeak);
+        mateOverflow+=counter.mateOverflow;
+        if (chromStats.size()<counter.chromStats.size()) chromStats.resize(counter.chromStats.size());
+        for (size_t i=0; i<counter.chromStats.size(); ++i) chromStats[i].add(counter.chromStats[i]);
+        if (cells) cells->merge(*counter.cells);
+    }
+    //done with a chromosome or a part of it, seconds is the time spent on it, decoding included
+    void closeChrom(int chromId, double seconds){
+        if (chromStats.size()<=(size_t)chromId) chromStats.resize(chromId+1);
+        stats.countSeconds=seconds-stats.decodeSeconds;
+        chromStats[chromId].add(stats);
+        stats=Stats();
+    }
+    //the stamps are only needed while counting
+    void releaseStamps(){
+        vector<uint64_t>().swap(incStamp);
+        vector<uint64_t>().swap(cntStamp);
+        vector<uint64_t>().swap(skipStamp);
+    }
+};
+template<bool stats=false> void countInc(int32_t chromStart, int32_t chromEnd, char strand, int weight, const struct IntronIndex* index, struct Counter *counter){
+    int span=counter->settings.span;
+    auto count=[&](uint32_t id, bool inc, bool cnt){
+        if (inc && counter->incStamp[id]!=counter->readId){
+            counter->incStamp[id]=counter->readId;
+            counter->incCount[id]+=weight;
+            if (counter->cells) counter->cells->add(id, CellCounts::inc, weight, counter->origin);
+        }
+        if (cnt && counter->cntStamp[id]!=counter->readId){
+            counter->cntStamp[id]=counter->readId;
+            counter->cntCount[id]+=weight;
+            if (counter->cells) counter->cells->add(id, CellCounts::cnt, weight, counter->origin);
+        }
+    };
+    index->overlapRanges(chromStart, chromEnd, [&](int32_t i0, int32_t i1){
+        //the linearly scanned subtrees are tested with the vector unit, one intron at a time otherwise
+        if (testIntrons && i1-i0>1){
+            //the introns the scalar loop would test, those starting before the end, so that the statistics do not depend on the kernel
+            if (stats) counter->stats.tested+=lower_bound(index->starts+i0, index->starts+i1, chromEnd)-(index->starts+i0);
+            uint64_t inc, cnt;
+            testIntrons(index->starts+i0, index->ends+i0, index->strands+i0, i1-i0, chromStart, chromEnd, strand, span, &inc, &cnt);
+            for (uint64_t hit=inc|cnt; hit; hit&=hit-1){
+                int j=__builtin_ctzll(hit);
+                count(index->ids[i0+j], inc>>j&1, cnt>>j&1);
+            }
+            return;
+        }
+        int32_t overlap, leftSpan, rightSpan;
+        for (int32_t i=i0; i<i1 && index->starts[i]<chromEnd; ++i){
+            if (stats) counter->stats.tested++;
+            if (index->ends[i]<=chromStart) continue;
+            if (strand == '.' || strand == index->strands[i]){
+                overlap=min(index->ends[i], chromEnd)-max(index->starts[i], chromStart);
+                if (overlap>=span){
+                    leftSpan=index->starts[i]-chromStart;
+                    rightSpan=chromEnd-index->ends[i];
+                    count(index->ids[i], leftSpan>=span || rightSpan>=span, leftSpan<=0 && rightSpan<=0);
+                }
+            }
+        }
+    });
+}
+//count the gathered segments, each under the id of its read. Needed after the last read of a task
+template<bool stats=false> void countSegments(struct Counter *counter){
+    uint64_t readId=counter->readId;
+    struct Origin origin=counter->origin;
+    for (auto &segment: counter->segments){
+        counter->readId=segment.readId;
+        counter->origin=segment.origin;
+        countInc<stats>(segment.start, segment.end, segment.strand, segment.weight, counter->segmentIndex, counter);
+    }
+    counter->readId=readId;
+    counter->origin=origin;
+    counter->segments.clear();
+}
+template<bool stats=false> void countSkip(int32_t chromStart, int32_t chromEnd, int32_t lastChromStart, int32_t lastChromEnd, char strand, int weight, const struct IntronIndex* index, struct Counter *counter){
+    int span=counter->settings.span;
+    if (lastChromEnd-lastChromStart<=span || chromEnd-chromStart<=span) return;
+    int64_t id;
+    if (strand=='+' || strand=='.'){
+        id=index->junction(junctionKey(lastChromEnd, chromStart));
+        if (stats) counter->stats.junctionLookups++, counter->stats.junctionHits+=id>=0;
+        if (id>=0 && counter->skipStamp[id]!=counter->readId){
+            counter->skipStamp[id]=counter->readId;
+            counter->skipCount[id]+=weight;
+            if (counter->cells) counter->cells->add(id, CellCounts::skip, weight, counter->origin);
+        }
+    }
+    if (strand=='-' || strand=='.'){
+        id=index->junction(junctionKey(chromStart, lastChromEnd));
+        if (stats) counter->stats.junctionLookups++, counter->stats.junctionHits+=id>=0;
+        if (id>=0 && counter->skipStamp[id]!=counter->readId){
+            counter->skipStamp[id]=counter->readId;
+            counter->skipCount[id]+=weight;
+            if (counter->cells) counter->cells->add(id, CellCounts::skip, weight, counter->origin);
+        }
+    }
+}
+/* the junctions of an alignment between each two segments, whether or not an intron is near. The strand
+ * given by the aligner is used for reads of unstranded libraries */
+inline void tallyJunctions(int32_t position, const uint32_t *cigar, int cigarNum, char strand, int weight, struct Counter *counter){
+    if (strand=='.' && counter->origin.strand) strand=counter->origin.strand;
+    auto &table=counter->junctions->tables[counter->origin.chromId];
+    int32_t segmentStart=position, segmentEnd=position, junctionStart=-1, leftAnchor=0;
+    for (int i=0; i<=cigarNum; ++i){
+        if (i==cigarNum || getCigarOp(cigar[i])==BAM_CREF_SKIP){
+            //the junction before this segment is complete with its right anchor
+            if (junctionStart>=0) table.add(junctionStart, segmentStart, strand, min(leftAnchor, segmentEnd-segmentStart), weight, counter->readId);
+            if (i==cigarNum) break;
+            junctionStart=segmentEnd;
+            leftAnchor=segmentEnd-segmentStart;
+            segmentStart=segmentEnd=segmentEnd+getCigarOplen(cigar[i]);
+        }
+        else if (getCigarType(cigar[i]) & 2u) segmentEnd+=getCigarOplen(cigar[i]);
+    }
+}
+//count an alignment once for weight identical reads, under the read id of the caller
+template<bool stats=false> void countAlignment(int32_t position, const uint32_t *cigar, int cigarNum, char strand, int weight, const struct IntronIndex* index, struct Counter *counter){
+    //a read without strand counts no intron, nor junction
+    if (counter->junctions && strand) tallyJunctions(position, cigar, cigarNum, strand, weight, counter);
+    int32_t chromStart, chromEnd, lastChromStart, lastChromEnd;
+    chromEnd=position;
+    for (int i=0; i<cigarNum; ++i) if (getCigarType(cigar[i]) & 2u) chromEnd+=getCigarOplen(cigar[i]);
+    if (!index->near(position, chromEnd)) return;
+    if (index!=counter->segmentIndex){
+        countSegments<stats>(counter);
+        counter->segmentIndex=index;
+    }
+
+    chromStart=position;
+    chromEnd=chromStart;
+    lastChromStart=lastChromEnd=0;
+    int i=0;
+    while(i<cigarNum){
+        while(i<cigarNum && getCigarOp(cigar[i])!=3){ //Until an 'N' is reached or the cigar is finished
+            if (getCigarType(cigar[i]) & 2u) chromEnd+=getCigarOplen(cigar[i]);
+            ++i;
+        }
+        counter->segments.push_back({chromStart, chromEnd, strand, weight, counter->readId, counter->origin});
+        // nothing will be count if there is no last positions
+        countSkip<stats>(chromStart, chromEnd, lastChromStart, lastChromEnd, strand, weight, index, counter);
+        if (i<cigarNum){
+            lastChromStart=chromStart;
+            lastChromEnd=chromEnd;
+            chromStart=chromEnd+getCigarOplen(cigar[i]);
+            chromEnd=chromStart;
+            ++i;
+        }
+    }
+    if (counter->segments.size()>=Counter::batchSize) countSegments<stats>(counter);
+}
+/* the library settings the per-read checks depend on. They are fixed for a run, so the counting loops are
+ * instantiated for each combination and do not branch on them for every read. The statistics are only
+ * gathered by the loops instantiated for --stats */
+template<int libraryType, bool isPaired, bool unique, bool gather=false> struct Library{
+    static const bool stats=gather;
+    static bool proper(bam1_t *b){return isProper<isPaired, unique>(b);}
+    static char strand(bam1_t *b){return getStrand<libraryType, isPaired>(b);}
+};
+//barcode mode: the cell and umi of a record as the origin of the counts, false if it lacks either tag
+inline bool readOrigin(bam1_t *b, struct Counter *counter){
+    const char *barcode=getAuxString(b, counter->settings.barcodeTag);
+    if (!barcode) return false;
+    counter->origin.cell=counter->cells->cell(barcode);
+    if (counter->settings.umiTag){
+        const char *umi=getAuxString(b, counter->settings.umiTag);
+        if (!umi) return false;
+        counter->origin.umi=CellCounts::hash(umi);
+    }
+    return true;
+}
+/* the paired and unique checks of a record, also counting the filtered and spliced ones with --stats. In
+ * barcode mode and with --junctions the origin of the record is set, callers keep it for the counts of the record */
+template<class L> bool checkRead(bam1_t *b, struct Counter *counter){
+    if (!L::proper(b) || (counter->cells && !readOrigin(b, counter))){
+        if (L::stats) counter->stats.filtered++;
+        return false;
+    }
+    if (counter->junctions){
+        counter->origin.chromId=b->core.tid;
+        counter->origin.strand=0;
+        const uint8_t *xs;
+        if (L::strand(b)=='.' && (xs=bam_aux_get(b, "XS"))!=nullptr && xs[0]=='A' && (xs[1]=='+' || xs[1]=='-')) counter->origin.strand=xs[1];
+    }
+    if (L::stats && isSpliced(b)) counter->stats.spliced++;
+    return true;
+}
+template<class L> void countRead(bam1_t *b, const struct IntronIndex* index, struct Counter *counter){
+    if (!checkRead<L>(b, counter)) return;
+    counter->readId++;
+    countAlignment<L::stats>(getPosition(b), getCigar(b), getCigarNum(b), L::strand(b), 1, index, counter);
+}
+/* In deep loci many reads share the start, cigar and strand and count exactly the same introns.
+ * The reads starting at the current position are grouped by cigar and strand, and each group is
+ * counted once with its size when a read starting elsewhere, or on another chromosome, comes in.
+ * The input is sorted, so the groups are complete by then. */
+template<class L> struct Collapser{
+    struct Group{
+        char strand;
+        int weight;
+        struct Origin origin;
+        vector<uint32_t> cigar;
+    };
+    static const size_t maxGroups=64;
+    const struct IntronIndex* index=nullptr;
+    int32_t position=-1;
+    vector<struct Group> groups;
+    size_t groupNum=0; //groups in use, the cigar buffers of the others are kept for reuse
+    void add(bam1_t *b, const struct IntronIndex* index, struct Counter *counter){
+        if (!checkRead<L>(b, counter)) return;
+        struct Origin origin=counter->origin;
+        int32_t position=getPosition(b);
+        if (index!=this->index || position!=this->position || groupNum==maxGroups){
+            flush(counter);
+            this->index=index;
+            this->position=position;
+        }
+        char strand=L::strand(b);
+        const uint32_t *cigar=getCigar(b);
+        const int cigarNum=getCigarNum(b);
+        for (size_t i=0; i<groupNum; ++i){
+            struct Group &group=groups[i];
+            if (group.strand==strand && group.origin.cell==origin.cell && group.origin.umi==origin.umi && group.origin.strand==origin.strand && group.cigar.size()==(size_t)cigarNum && equal(cigar, cigar+cigarNum, group.cigar.begin())){
+                group.weight++;
+                return;
+            }
+        }
+        if (groupNum==groups.size()) groups.emplace_back();
+        struct Group &group=groups[groupNum++];
+        group.strand=strand;
+        group.weight=1;
+        group.origin=origin;
+        group.cigar.assign(cigar, cigar+cigarNum);
+    }
+    //count the pending groups, needed after the last read of a task
+    void flush(struct Counter *counter){
+        for (size_t i=0; i<groupNum; ++i){
+            struct Group &group=groups[i];
+            counter->readId++;
+            counter->origin=group.origin;
+            countAlignment<L::stats>(position, group.cigar.data(), group.cigar.size(), group.strand, group.weight, index, counter);
+        }
+        groupNum=0;
+        countSegments<L::stats>(counter);
+    }
+};
+/* Fragment mode: the two mates of a pair are counted under one read id, so that a fragment counts each
+ * intron once even if both mates overlap it. The mate coming first waits in a table keyed by its name
+ * and mate position until the other one arrives. The input is sorted, so a mate still waiting once the
+ * position has passed its mate position will not be paired and is counted alone, as are mates on
+ * another chromosome. The table holds at most mateBuffer mates, beyond that the one expected first is
+ * counted alone. */
+template<class L> struct MatePairer{
+    struct Mate{
+        int32_t position;
+        char strand;
+        bool paired; //paired mates are only removed once the position has passed them
+        struct Origin origin;
+        vector<uint32_t> cigar;
+    };
+    typedef pair<const string, struct Mate> Entry;
+    struct Later{
+        bool operator()(const pair<int32_t, Entry*> &i, const pair<int32_t, Entry*> &j) const{
+            return i.first>j.first;
+        }
+    };
+    const struct IntronIndex* index=nullptr;
+    unordered_map<string, struct Mate> pending;
+    //the stored mates by mate position, the elements of an unordered_map keep their address on rehash
+    priority_queue<pair<int32_t, Entry*>, vector<pair<int32_t, Entry*>>, Later> expiry;
+    uint64_t bytes=0;
+    string key;
+    void setKey(bam1_t *b, int32_t position){
+        key.assign(getName(b));
+        key.append((const char*)&position, sizeof(position));
+    }
+    static uint64_t entryBytes(const Entry &entry){
+        return sizeof(Entry)+entry.first.size()+entry.second.cigar.size()*sizeof(uint32_t)+sizeof(pair<int32_t, Entry*>)+4*sizeof(void*);
+    }
+    void countMate(const struct Mate &mate, struct Counter *counter){
+        counter->origin=mate.origin;
+        countAlignment<L::stats>(mate.position, mate.cigar.data(), mate.cigar.size(), mate.strand, 1, index, counter);
+    }
+    //remove the first stored mate, counting it alone if it was not paired. Returns whether it was not
+    bool expire(struct Counter *counter){
+        Entry *entry=expiry.top().second;
+        expiry.pop();
+        bool alone=!entry->second.paired;
+        if (alone){
+            counter->readId++;
+            countMate(entry->second, counter);
+        }
+        bytes-=entryBytes(*entry);
+        pending.erase(pending.find(entry->first));
+        return alone;
+    }
+    void add(bam1_t *b, const struct IntronIndex* index, struct Counter *counter){
+        if (!checkRead<L>(b, counter)) return;
+        struct Origin origin=counter->origin; //counting the stored mates changes it
+        if (index!=this->index){
+            flush(counter);
+            this->index=index;
+        }
+        int32_t position=getPosition(b);
+        while (!expiry.empty() && expiry.top().first<position) expire(counter);
+        counter->origin=origin;
+        char strand=L::strand(b);
+        const uint32_t *cigar=getCigar(b);
+        const int cigarNum=getCigarNum(b);
+        int32_t matePosition=b->core.mpos;
+        bool mated=!(b->core.flag & BAM_FMUNMAP) && b->core.mtid==b->core.tid;
+        counter->readId++;
+        //a waiting mate was stored under the position of this one
+        if (mated && matePosition<=position){
+            setKey(b, position);
+            auto found=pending.find(key);
+            if (found!=pending.end() && !found->second.paired && found->second.position==matePosition){
+                found->second.paired=true;
+                countMate(found->second, counter);
+                counter->origin=origin;
+                countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+                return;
+            }
+        }
+        if (!mated || matePosition<position){
+            countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+            return;
+        }
+        setKey(b, matePosition);
+        if (pending.size()>=counter->settings.mateBuffer){
+            while (!expiry.empty() && !expire(counter));
+            counter->mateOverflow++;
+            counter->origin=origin;
+        }
+        auto inserted=pending.emplace(key, (struct Mate){position, strand, false, origin, vector<uint32_t>(cigar, cigar+cigarNum)});
+        if (!inserted.second){ //another alignment of the same name and mate position is stored
+            countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+            return;
+        }
+        Entry *entry=&*inserted.first;
+        expiry.emplace(matePosition, entry);
+        bytes+=entryBytes(*entry);
+        counter->matePeak=max(counter->matePeak, (uint64_t)pending.size());
+        counter->mateBytesPeak=max(counter->mateBytesPeak, bytes);
+    }
+    //count the mates still waiting, needed after the last read of a task
+    void flush(struct Counter *counter){
+        while (!expiry.empty()) expire(counter);
+        countSegments<L::stats>(counter);
+    }
+};
+/* Fragment mode for unsorted input: the mate coming first waits, keyed by its name and mate position, until
+ * the other one arrives, whatever the positions of the records in between. Mates of name sorted input
+ * arrive together and hardly wait. Beyond mateBuffer waiting mates the one waiting longest is counted
+ * alone, as are the mates still waiting at the end */
+template<class L> struct NamePairer{
+    struct Mate{
+        const struct IntronIndex* index;
+        int32_t position;
+        char strand;
+        struct Origin origin;
+        vector<uint32_t> cigar;
+        typename list<pair<const string, struct Mate>*>::iterator order;
+    };
+    typedef pair<const string, struct Mate> Entry;
+    unordered_map<string, struct Mate> pending;
+    list<Entry*> arrival; //the waiting mates, first come first
+    uint64_t bytes=0;
+    string key;
+    void setKey(bam1_t *b, int32_t position){
+        key.assign(getName(b));
+        key.append((const char*)&b->core.tid, sizeof(b->core.tid));
+        key.append((const char*)&position, sizeof(position));
+    }
+    static uint64_t entryBytes(const Entry &entry){
+        return sizeof(Entry)+entry.first.size()+entry.second.cigar.size()*sizeof(uint32_t)+3*sizeof(void*)+4*sizeof(void*);
+    }
+    void countMate(const struct Mate &mate, struct Counter *counter){
+        counter->origin=mate.origin;
+        countAlignment<L::stats>(mate.position, mate.cigar.data(), mate.cigar.size(), mate.strand, 1, mate.index, counter);
+    }
+    void remove(Entry *entry){
+        bytes-=entryBytes(*entry);
+        arrival.erase(entry->second.order);
+        pending.erase(pending.find(entry->first));
+    }
+    void add(bam1_t *b, const struct IntronIndex* index, struct Counter *counter){
+        if (!checkRead<L>(b, counter)) return;
+        struct Origin origin=counter->origin; //counting the stored mates changes it
+        int32_t position=getPosition(b);
+        char strand=L::strand(b);
+        const uint32_t *cigar=getCigar(b);
+        const int cigarNum=getCigarNum(b);
+        int32_t matePosition=b->core.mpos;
+        bool mated=!(b->core.flag & BAM_FMUNMAP) && b->core.mtid==b->core.tid;
+        counter->readId++;
+        if (!mated){
+            countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+            return;
+        }
+        //a waiting mate was stored under the position of this one
+        setKey(b, position);
+        auto found=pending.find(key);
+        if (found!=pending.end() && found->second.position==matePosition){
+            countMate(found->second, counter);
+            counter->origin=origin;
+            countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+            remove(&*found);
+            return;
+        }
+        setKey(b, matePosition);
+        if (pending.size()>=counter->settings.mateBuffer){
+            Entry *first=arrival.front();
+            counter->readId++;
+            countMate(first->second, counter);
+            remove(first);
+            counter->mateOverflow++;
+            counter->origin=origin;
+        }
+        auto inserted=pending.emplace(key, (struct Mate){index, position, strand, origin, vector<uint32_t>(cigar, cigar+cigarNum), arrival.end()});
+        if (!inserted.second){ //another alignment of the same name and mate position is waiting
+            countAlignment<L::stats>(position, cigar, cigarNum, strand, 1, index, counter);
+            return;
+        }
+        Entry *entry=&*inserted.first;
+        entry->second.order=arrival.insert(arrival.end(), entry);
+        bytes+=entryBytes(*entry);
+        counter->matePeak=max(counter->matePeak, (uint64_t)pending.size());
+        counter->mateBytesPeak=max(counter->mateBytesPeak, bytes);
+    }
+    //count the mates still waiting alone, needed after the last read
+    void flush(struct Counter *counter){
+        while (!arrival.empty()){
+            counter->readId++;
+            countMate(arrival.front()->second, counter);
+            remove(arrival.front());
+        }
+        countSegments<L::stats>(counter);
+    }
+};
+#endif
@@ -0,0 +1,513 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_INTRON_H
+#define IUCOUNT_INTRON_H
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <htslib/sam.h>
+using namespace std;
+
+/* introns in file order as flat arrays, the name of each chromosome is stored once. The arrays are either
+ * owned by the set when read in memory, or point into a mapped index file */
+struct IntronSet{
+    size_t n=0;
+    uint32_t chromCount=0;
+    const uint32_t *chroms=nullptr;
+    const uint32_t *starts=nullptr;
+    const uint32_t *ends=nullptr;
+    const char *strands=nullptr;
+    //null terminated names at their offsets, and the chromosome ids sorted by name for lookups
+    const char *names=nullptr;
+    const uint64_t *nameOffsets=nullptr;
+    const uint32_t *nameOrder=nullptr;
+    //storage of a set read in memory
+    vector<uint32_t> chromData, startData, endData;
+    vector<char> strandData, nameData;
+    vector<uint64_t> nameOffsetData;
+    vector<uint32_t> nameOrderData;
+    //the index file mapped by mapIntronIndex, released by unmapIntronIndex
+    void *map=nullptr;
+    size_t mapSize=0;
+    size_t size() const{
+        return n;
+    }
+    const char* chromName(uint32_t chrom) const{
+        return names+nameOffsets[chrom];
+    }
+    //the id of the chromosome of this name, -1 if there is none
+    int64_t chromId(const char *name) const{
+        auto last=nameOrder+chromCount;
+        auto it=lower_bound(nameOrder, last, name, [&](uint32_t chrom, const char *name){return strcmp(chromName(chrom), name)<0;});
+        return it!=last && strcmp(chromName(*it), name)==0?(int64_t)*it:-1;
+    }
+    void add(const char *chrom, uint32_t start, uint32_t end, char strand){
+        //introns mostly come grouped by chromosome, the chromosome of the last one is tried first
+        int64_t id=n>0 && strcmp(chromName(chroms[n-1]), chrom)==0?chroms[n-1]:chromId(chrom);
+        if (id<0){
+            id=chromCount;
+            nameOffsetData.push_back(nameData.size());
+            nameData.insert(nameData.end(), chrom, chrom+strlen(chrom)+1);
+            auto it=lower_bound(nameOrderData.begin(), nameOrderData.end(), chrom, [&](uint32_t i, const char *name){return strcmp(nameData.data()+nameOffsetData[i], name)<0;});
+            nameOrderData.insert(it, id);
+            ++chromCount;
+        }
+        chromData.push_back(id);
+        startData.push_back(start);
+        endData.push_back(end);
+        strandData.push_back(strand);
+        ++n;
+        chroms=chromData.data();
+        starts=startData.data();
+        ends=endData.data();
+        strands=strandData.data();
+        names=nameData.data();
+        nameOffsets=nameOffsetData.data();
+        nameOrder=nameOrderData.data();
+    }
+};
+
+/* the number of positions a read of the given length can take on an intron to count as inc, cnt and skip,
+ * with segments of at least span bases */
+struct EffectiveLength{
+    int inc;
+    int cnt;
+    int skip;
+};
+inline struct EffectiveLength effectiveLength(int intronLen, int readLen, int span){
+    struct EffectiveLength length;
+    length.skip=readLen-2*span+1;
+    length.inc=readLen-2*span+1+min(readLen-2*span+1, intronLen);
+    length.cnt=length.inc+max(0, intronLen-readLen+1);
+    return length;
+}
+//junction key of an intron as found between two segments of a read on its strand
+#define junctionKey(donor, acceptor) (((uint64_t)(donor)<<32u)+(acceptor))
+
+/* the introns of one chromosome, with two lookups:
+ * - an implicit augmented interval tree (the cgranges layout): introns sorted by start form an
+ *   implicit binary tree over their positions, and maxEnd holds the largest end within the subtree
+ *   of each node. A query costs O(log n) plus the number of overlaps, however long or nested the
+ *   introns are.
+ * - an open addressing table from junction keys to intron ids for the stranded introns.
+ * The arrays are either owned by the index when built in memory, or point into a mapped index file. */
+struct IntronIndex{
+    int32_t n=0;
+    const int32_t *starts=nullptr;
+    const int32_t *ends=nullptr;
+    const int32_t *maxEnd=nullptr;
+    const char *strands=nullptr;
+    const uint32_t *ids=nullptr;
+    int maxLevel=-1;
+    const uint64_t *junctionKeys=nullptr;
+    const uint32_t *junctionIds=nullptr;
+    uint64_t junctionMask=0;
+    static constexpr uint64_t emptyKey=UINT64_MAX;
+    //level of the subtrees scanned linearly by overlap queries, up to 31 introns
+    static const int leafLevel=4;
+    //merged spans of the introns sorted by start, only reads overlapping them can be counted
+    const pair<int32_t, int32_t> *regions=nullptr;
+    int32_t regionCount=0;
+    //one bit per block of 2^coverageShift bases overlapped by an intron, to pass over reads far from any intron
+    static const int coverageShift=8;
+    const uint64_t *coverage=nullptr;
+    uint64_t coverageWords=0;
+    //storage of an index built in memory
+    vector<int32_t> startData, endData, maxEndData;
+    vector<char> strandData;
+    vector<uint32_t> idData;
+    vector<uint64_t> junctionKeyData;
+    vector<uint32_t> junctionIdData;
+    vector<pair<int32_t, int32_t>> regionData;
+    vector<uint64_t> coverageData;
+
+    static uint64_t hash(uint64_t key){
+        return key*0x9E3779B97F4A7C15ull;
+    }
+    //members are intron ids in file order, a junction shared by several introns maps to the last one
+    void build(const struct IntronSet &introns, const vector<uint32_t> &members){
+        n=members.size();
+        uint64_t capacity=16;
+        while (capacity<2*(uint64_t)n) capacity<<=1u;
+        junctionMask=capacity-1;
+        junctionKeyData.assign(capacity, (uint64_t)emptyKey);
+        junctionIdData.assign(capacity, 0);
+        for (auto id: members){
+            if (introns.strands[id]=='+') addJunction(junctionKey(introns.starts[id], introns.ends[id]), id);
+            else if (introns.strands[id]=='-') addJunction(junctionKey(introns.ends[id], introns.starts[id]), id);
+        }
+
+        idData=members;
+        stable_sort(idData.begin(), idData.end(), [&](uint32_t i, uint32_t j){return introns.starts[i]<introns.starts[j];});
+        startData.resize(n);
+        endData.resize(n);
+        strandData.resize(n);
+        maxEndData.resize(n);
+        for (int32_t i=0; i<n; ++i){
+            startData[i]=introns.starts[idData[i]];
+            endData[i]=introns.ends[idData[i]];
+            strandData[i]=introns.strands[idData[i]];
+        }
+        starts=startData.data();
+        ends=endData.data();
+        maxEnd=maxEndData.data();
+        strands=strandData.data();
+        ids=idData.data();
+        junctionKeys=junctionKeyData.data();
+        junctionIds=junctionIdData.data();
+        maxLevel=levels(n);
+        if (n==0) return;
+        int32_t lastI=0, last=0;
+        int k;
+        for (int32_t i=0; i<n; i+=2) lastI=i, last=maxEndData[i]=ends[i];
+        for (k=1; 1LL<<k<=n; ++k){
+            int32_t x=1<<(k-1), i0=(x<<1)-1, step=x<<2;
+            for (int32_t i=i0; i<n; i+=step){
+                int32_t el=maxEndData[i-x];
+                int32_t er=i+x<n?maxEndData[i+x]:last;
+                int32_t e=ends[i];
+                e=max(e, el);
+                e=max(e, er);
+                maxEndData[i]=e;
+            }
+            lastI=lastI>>k&1?lastI-x:lastI+x; //the parent of the rightmost node
+            if (lastI<n && maxEndData[lastI]>last) last=maxEndData[lastI];
+        }
+        buildRegions();
+    }
+    void buildRegions(){
+        for (int32_t i=0; i<n; ++i){
+            if (!regionData.empty() && starts[i]<=regionData.back().second) regionData.back().second=max(regionData.back().second, ends[i]);
+            else regionData.emplace_back(starts[i], ends[i]);
+        }
+        if (!regionData.empty()){
+            coverageData.assign(((regionData.back().second>>coverageShift)>>6)+1, 0);
+            for (auto &region: regionData)
+                for (int32_t k=region.first>>coverageShift; k<=(region.second-1)>>coverageShift; ++k) coverageData[k>>6]|=1ull<<(k&63);
+        }
+        regions=regionData.data();
+        regionCount=regionData.size();
+        coverage=coverageData.data();
+        coverageWords=coverageData.size();
+    }
+    //whether [start, end) may overlap an intron
+    bool near(int32_t start, int32_t end) const{
+        if (end<=start) return false;
+        uint64_t first=start>>coverageShift, last=(end-1)>>coverageShift;
+        if ((first>>6)>=coverageWords) return false;
+        last=min(last, coverageWords*64-1);
+        for (uint64_t w=first>>6; w<=last>>6; ++w){
+            uint64_t word=coverage[w];
+            if (w==first>>6) word&=~0ull<<(first&63);
+            if (w==last>>6) word&=~0ull>>(63-(last&63));
+            if (word) return true;
+        }
+        return false;
+    }
+    //level of the root of the implicit tree over n introns, -1 for an empty tree
+    static int levels(int32_t n){
+        int k=-1;
+        while (k<30 && 1LL<<(k+1)<=n) ++k;
+        return k;
+    }
+    void addJunction(uint64_t key, uint32_t id){
+        uint64_t i=hash(key)>>32u&junctionMask;
+        while (junctionKeyData[i]!=emptyKey && junctionKeyData[i]!=key) i=(i+1)&junctionMask;
+        junctionKeyData[i]=key;
+        junctionIdData[i]=id;
+    }
+    //the id of the intron with this junction key, -1 if there is none
+    int64_t junction(uint64_t key) const{
+        if (!junctionKeys) return -1;
+        uint64_t i=hash(key)>>32u&junctionMask;
+        while (junctionKeys[i]!=key){
+            if (junctionKeys[i]==emptyKey) return -1;
+            i=(i+1)&junctionMask;
+        }
+        return junctionIds[i];
+    }
+    /* call f(i0, i1) with ranges of positions holding every intron having start<end and end>start: the
+     * small subtrees scanned linearly come as a whole, up to 31 introns of which some may not overlap,
+     * and the other nodes one at a time. Only the overlapping introns of a range need to be tested */
+    template<typename F> void overlapRanges(int32_t start, int32_t end, F f) const{
+        struct Cell{int32_t x; int16_t k; int16_t w;} stack[64];
+        int t=0;
+        if (maxLevel<0) return;
+        stack[t++]={(1<<maxLevel)-1, (int16_t)maxLevel, 0};
+        while (t){
+            Cell z=stack[--t];
+            if (z.k<=leafLevel){ //small subtrees are scanned linearly
+                int32_t i0=z.x>>z.k<<z.k, i1=i0+(1<<(z.k+1))-1;
+                if (i1>=n) i1=n;
+                if (i0<i1 && starts[i0]<end) f(i0, i1);
+            }
+            else if (z.w==0){ //visit the left child first
+                int32_t y=z.x-(1<<(z.k-1));
+                stack[t++]={z.x, z.k, 1};
+                if (y>=n || maxEnd[y]>start) stack[t++]={y, (int16_t)(z.k-1), 0};
+            }
+            else if (z.x<n && starts[z.x]<end){
+                if (start<ends[z.x]) f(z.x, z.x+1);
+                stack[t++]={z.x+(1<<(z.k-1)), (int16_t)(z.k-1), 0};
+            }
+        }
+    }
+    //call f with the position of every intron having start<end and end>start
+    template<typename F> void overlap(int32_t start, int32_t end, F f) const{
+        overlapRanges(start, end, [&](int32_t i0, int32_t i1){
+            for (int32_t i=i0; i<i1 && starts[i]<end; ++i)
+                if (start<ends[i]) f(i);
+        });
+    }
+};
+
+//one index per chromosome of the intron set
+inline struct IntronIndex* buildIndices(const struct IntronSet &introns){
+    auto indices=new struct IntronIndex[introns.chromCount];
+    vector<vector<uint32_t>> members(introns.chromCount);
+    for (uint32_t i=0; i<introns.size(); ++i) members[introns.chroms[i]].push_back(i);
+    for (uint32_t i=0; i<introns.chromCount; ++i) indices[i].build(introns, members[i]);
+    return indices;
+}
+//the index of every chromosome of the bam header, introns on chromosomes absent from the header are left out
+inline vector<const struct IntronIndex*> indicesByTarget(const struct IntronSet &introns, const struct IntronIndex *indices, const bam_hdr_t *header){
+    static const struct IntronIndex noIntrons;
+    vector<const struct IntronIndex*> targets(header->n_targets, &noIntrons);
+    vector<bool> found(introns.chromCount);
+    for (int i=0; i<header->n_targets; ++i){
+        int64_t chrom=introns.chromId(header->target_name[i]);
+        if (chrom<0) continue;
+        targets[i]=&indices[chrom];
+        found[chrom]=true;
+    }
+    for (uint32_t i=0; i<introns.chromCount; ++i)
+        if (!found[i]) cerr<<"[warning] chromosome "<<introns.chromName(i)<<" not found in the bam header"<<endl;
+    return targets;
+}
+
+/* binary intron index written by "iucount index", all offsets are in bytes from the start of the
+ * file and every array is 8 byte aligned, so that the file is mapped and used in place, without
+ * parsing or copying anything:
+ *   header
+ *   one IndexChrom per chromosome
+ *   chromosome names, null terminated, their offsets within the names and the chromosome ids sorted by name
+ *   chroms, starts, ends and strands of the introns in file order
+ *   for each chromosome the arrays of its IntronIndex, with its regions and coverage */
+#define INTRON_INDEX_MAGIC "IUCIDX\1\0"
+#define INTRON_INDEX_VERSION 2u
+#define INTRON_INDEX_BYTE_ORDER 0x01020304u
+struct IndexHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t intronCount;
+    uint64_t chromCount;
+    uint64_t namesSize;
+    uint64_t names, nameOffsets, nameOrder;
+    uint64_t chroms, starts, ends, strands;
+};
+struct IndexChrom{
+    int32_t n;
+    int32_t maxLevel;
+    uint64_t junctionMask;
+    int32_t regionCount;
+    int32_t reserved;
+    uint64_t coverageWords;
+    uint64_t starts, ends, maxEnd, strands, ids, junctionKeys, junctionIds, regions, coverage;
+};
+static_assert(sizeof(pair<int32_t, int32_t>)==8, "regions are written as pairs of int32");
+inline int writeIntronIndex(const char *fn, const struct IntronSet &introns, const struct IntronIndex *indices){
+    vector<char> buffer;
+    auto append=[&](const void *data, size_t size){
+        buffer.resize((buffer.size()+7)&~(size_t)7);
+        uint64_t offset=buffer.size();
+        if (size) buffer.insert(buffer.end(), (const char*)data, (const char*)data+size);
+        return offset;
+    };
+    struct IndexHeader header={};
+    memcpy(header.magic, INTRON_INDEX_MAGIC, 8);
+    header.version=INTRON_INDEX_VERSION;
+    header.byteOrder=INTRON_INDEX_BYTE_ORDER;
+    header.intronCount=introns.size();
+    header.chromCount=introns.chromCount;
+    vector<struct IndexChrom> chroms(header.chromCount);
+    append(&header, sizeof(header));
+    uint64_t chromTable=append(chroms.data(), chroms.size()*sizeof(struct IndexChrom));
+    for (uint32_t i=0; i<introns.chromCount; ++i) header.namesSize=max(header.namesSize, introns.nameOffsets[i]+strlen(introns.chromName(i))+1);
+    header.names=append(introns.names, header.namesSize);
+    header.nameOffsets=append(introns.nameOffsets, introns.chromCount*sizeof(uint64_t));
+    header.nameOrder=append(introns.nameOrder, introns.chromCount*sizeof(uint32_t));
+    header.chroms=append(introns.chroms, introns.size()*sizeof(uint32_t));
+    header.starts=append(introns.starts, introns.size()*sizeof(uint32_t));
+    header.ends=append(introns.ends, introns.size()*sizeof(uint32_t));
+    header.strands=append(introns.strands, introns.size());
+    for (size_t i=0; i<chroms.size(); ++i){
+        auto &index=indices[i];
+        auto &chrom=chroms[i];
+        chrom.n=index.n;
+        chrom.maxLevel=index.maxLevel;
+        chrom.junctionMask=index.junctionMask;
+        chrom.regionCount=index.regionCount;
+        chrom.coverageWords=index.coverageWords;
+        chrom.starts=append(index.starts, index.n*sizeof(int32_t));
+        chrom.ends=append(index.ends, index.n*sizeof(int32_t));
+        chrom.maxEnd=append(index.maxEnd, index.n*sizeof(int32_t));
+        chrom.strands=append(index.strands, index.n);
+        chrom.ids=append(index.ids, index.n*sizeof(uint32_t));
+        chrom.junctionKeys=append(index.junctionKeys, (index.junctionMask+1)*sizeof(uint64_t));
+        chrom.junctionIds=append(index.junctionIds, (index.junctionMask+1)*sizeof(uint32_t));
+        chrom.regions=append(index.regions, index.regionCount*sizeof(pair<int32_t, int32_t>));
+        chrom.coverage=append(index.coverage, index.coverageWords*sizeof(uint64_t));
+    }
+    header.fileSize=buffer.size();
+    memcpy(buffer.data(), &header, sizeof(header));
+    memcpy(buffer.data()+chromTable, chroms.data(), chroms.size()*sizeof(struct IndexChrom));
+    FILE *fp=fopen(fn, "wb");
+    if (!fp) return 0;
+    size_t written=fwrite(buffer.data(), 1, buffer.size(), fp);
+    return fclose(fp)==0 && written==buffer.size();
+}
+//whether the file starts with the magic of a binary intron index
+inline bool isIntronIndex(const char *fn){
+    char magic[8];
+    FILE *fp=fopen(fn, "rb");
+    if (!fp) return false;
+    bool ret=fread(magic, 1, 8, fp)==8 && memcmp(magic, INTRON_INDEX_MAGIC, 8)==0;
+    fclose(fp);
+    return ret;
+}
+/* map a binary intron index, the intron set and the indices point into the mapping, which is kept until
+ * unmapIntronIndex is called on the set. Nothing is parsed or copied: the header, the bounds of the arrays
+ * and the ids indexing other arrays are checked in one pass, so that a truncated or stale index is refused
+ * instead of counted out of bounds. Returns nullptr if the file is not a valid index of this version */
+inline struct IntronIndex* mapIntronIndex(const char *fn, struct IntronSet *introns){
+    int fd=open(fn, O_RDONLY);
+    if (fd<0) return nullptr;
+    struct stat st;
+    if (fstat(fd, &st)!=0 || (size_t)st.st_size<sizeof(struct IndexHeader)){
+        close(fd);
+        return nullptr;
+    }
+    size_t size=st.st_size;
+    void *map=mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map==MAP_FAILED) return nullptr;
+    const char *data=(const char*)map;
+    auto header=(const struct IndexHeader*)data;
+    //every array must lie within the file
+    auto within=[&](uint64_t offset, uint64_t count, uint64_t width){
+        return offset%8==0 && offset<=size && count<=(size-offset)/width;
+    };
+    bool valid=memcmp(header->magic, INTRON_INDEX_MAGIC, 8)==0 && header->version==INTRON_INDEX_VERSION && header->byteOrder==INTRON_INDEX_BYTE_ORDER &&
+               header->fileSize==size && header->intronCount<UINT32_MAX && header->chromCount<UINT32_MAX &&
+               within(sizeof(struct IndexHeader), header->chromCount, sizeof(struct IndexChrom)) &&
+               within(header->names, header->namesSize, 1) && (header->chromCount==0 || (header->namesSize>0 && data[header->names+header->namesSize-1]=='\0')) &&
+               within(header->nameOffsets, header->chromCount, 8) && within(header->nameOrder, header->chromCount, 4) &&
+               within(header->chroms, header->intronCount, 4) && within(header->starts, header->intronCount, 4) &&
+               within(header->ends, header->intronCount, 4) && within(header->strands, header->intronCount, 1);
+    //the ids used to index other arrays must lie within them
+    for (uint64_t i=0; valid && i<header->chromCount; ++i){
+        valid=((const uint64_t*)(data+header->nameOffsets))[i]<header->namesSize &&
+              ((const uint32_t*)(data+header->nameOrder))[i]<header->chromCount;
+    }
+    for (uint64_t i=0; valid && i<header->intronCount; ++i) valid=((const uint32_t*)(data+header->chroms))[i]<header->chromCount;
+    auto chroms=(const struct IndexChrom*)(data+sizeof(struct IndexHeader));
+    for (uint64_t i=0; valid && i<header->chromCount; ++i){
+        auto &chrom=chroms[i];
+        uint64_t capacity=chrom.junctionMask+1;
+        valid=chrom.n>=0 && (uint64_t)chrom.n<=header->intronCount && (capacity&chrom.junctionMask)==0 && capacity>=2*(uint64_t)chrom.n &&
+              chrom.maxLevel==IntronIndex::levels(chrom.n) && chrom.regionCount>=0 && chrom.regionCount<=chrom.n &&
+              within(chrom.starts, chrom.n, 4) && within(chrom.ends, chrom.n, 4) && within(chrom.maxEnd, chrom.n, 4) &&
+              within(chrom.strands, chrom.n, 1) && within(chrom.ids, chrom.n, 4) &&
+              within(chrom.junctionKeys, capacity, 8) && within(chrom.junctionIds, capacity, 4) &&
+              within(chrom.regions, chrom.regionCount, 8) && within(chrom.coverage, chrom.coverageWords, 8);
+        auto ids=(const uint32_t*)(data+chrom.ids);
+        for (int32_t j=0; valid && j<chrom.n; ++j) valid=ids[j]<header->intronCount;
+        //a junction lookup ends at an empty slot, of which there must be some
+        auto keys=(const uint64_t*)(data+chrom.junctionKeys);
+        auto junctionIds=(const uint32_t*)(data+chrom.junctionIds);
+        uint64_t used=0;
+        for (uint64_t j=0; valid && j<capacity; ++j){
+            if (keys[j]==IntronIndex::emptyKey) continue;
+            ++used;
+            valid=junctionIds[j]<header->intronCount;
+        }
+        valid&=used<=(uint64_t)chrom.n;
+    }
+    if (!valid){
+        munmap(map, size);
+        return nullptr;
+    }
+    introns->map=map;
+    introns->mapSize=size;
+    introns->n=header->intronCount;
+    introns->chromCount=header->chromCount;
+    introns->names=data+header->names;
+    introns->nameOffsets=(const uint64_t*)(data+header->nameOffsets);
+    introns->nameOrder=(const uint32_t*)(data+header->nameOrder);
+    introns->chroms=(const uint32_t*)(data+header->chroms);
+    introns->starts=(const uint32_t*)(data+header->starts);
+    introns->ends=(const uint32_t*)(data+header->ends);
+    introns->strands=data+header->strands;
+    auto indices=new struct IntronIndex[header->chromCount];
+    for (uint64_t i=0; i<header->chromCount; ++i){
+        auto &chrom=chroms[i];
+        auto &index=indices[i];
+        index.n=chrom.n;
+        index.maxLevel=chrom.maxLevel;
+        index.junctionMask=chrom.junctionMask;
+        index.starts=(const int32_t*)(data+chrom.starts);
+        index.ends=(const int32_t*)(data+chrom.ends);
+        index.maxEnd=(const int32_t*)(data+chrom.maxEnd);
+        index.strands=data+chrom.strands;
+        index.ids=(const uint32_t*)(data+chrom.ids);
+        index.junctionKeys=(const uint64_t*)(data+chrom.junctionKeys);
+        index.junctionIds=(const uint32_t*)(data+chrom.junctionIds);
+        index.regions=(const pair<int32_t, int32_t>*)(data+chrom.regions);
+        index.regionCount=chrom.regionCount;
+        index.coverage=(const uint64_t*)(data+chrom.coverage);
+        index.coverageWords=chrom.coverageWords;
+    }
+    return indices;
+}
+//release the mapping of an index, the set and the indices of mapIntronIndex are not to be used afterwards
+inline void unmapIntronIndex(struct IntronSet *introns){
+    if (introns->map) munmap(introns->map, introns->mapSize);
+    introns->map=nullptr;
+    introns->mapSize=0;
+}
+
+#endif
@@ -0,0 +1,242 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <list>
+#include "iucount.h"
+#include "annotation.h"
+#include "bam.h"
+#include "utility.h"
+#include "count.h"
+using namespace std;
+
+static_assert(IUCOUNT_FR_UNSTRANDED==FRUNSTRANDED && IUCOUNT_FR_FIRSTSTRAND==FRFIRSTSTRAND && IUCOUNT_FR_SECONDSTRAND==FRSECONDSTRAND, "library types differ");
+
+struct IucountIntrons{
+    struct IntronSet set;
+    struct IntronIndex *indices=nullptr;
+};
+//the reads of a counter waiting to be counted between pushes
+template<class L> struct Pending{
+    Collapser<L> collapser;
+    MatePairer<L> matePairer;
+    NamePairer<L> namePairer;
+};
+struct IucountCounter{
+    const struct IucountIntrons *introns;
+    struct IucountOptions options;
+    vector<const struct IntronIndex*> targets;
+    struct Counter counter;
+    //the counting functions instantiated for the library of the options, and their pending reads
+    int (*push)(struct IucountCounter*, bam1_t *const*, size_t)=nullptr;
+    void (*finish)(struct IucountCounter*)=nullptr;
+    void (*release)(void*)=nullptr;
+    void *pending=nullptr;
+    //sorted records: the chromosome being counted, the chromosomes already passed and the last position
+    int chromId=-1;
+    bool failed=false; //records came out of order, nothing is counted until the pass is finished
+    vector<bool> visited;
+    int32_t lastPosition=0;
+    IucountCounter(const struct IucountIntrons *introns, const struct IucountOptions &options, const struct CountSettings &settings):
+        introns(introns), options(options), counter(introns->set.size(), settings){}
+    ~IucountCounter(){
+        if (release) release(pending);
+    }
+};
+
+struct IucountIntrons* iucountLoadIntrons(const char *fn){
+    auto introns=new struct IucountIntrons;
+    if (isIntronIndex(fn)){
+        introns->indices=mapIntronIndex(fn, &introns->set);
+        if (!introns->indices){
+            cerr<<"[error] invalid or incompatible intron index "<<fn<<", please rebuild it with iucount index"<<endl;
+            delete introns;
+            return nullptr;
+        }
+    }
+    else {
+        if (!readIntrons(fn, &introns->set)){
+            delete introns;
+            return nullptr;
+        }
+        introns->indices=buildIndices(introns->set);
+    }
+    return introns;
+}
+size_t iucountIntronCount(const struct IucountIntrons *introns){
+    return introns->set.size();
+}
+bool iucountIntron(const struct IucountIntrons *introns, size_t id, const char **chrom, uint32_t *start, uint32_t *end, char *strand){
+    auto &set=introns->set;
+    if (id>=set.size()) return false;
+    *chrom=set.chromName(set.chroms[id]);
+    *start=set.starts[id];
+    *end=set.ends[id];
+    *strand=set.strands[id];
+    return true;
+}
+bool iucountEffectiveLength(const struct IucountIntrons *introns, size_t id, int readLen, int span, int *inc, int *cnt, int *skip){
+    auto &set=introns->set;
+    if (id>=set.size()) return false;
+    auto length=effectiveLength(set.ends[id]-set.starts[id], readLen, span);
+    *inc=length.inc;
+    *cnt=length.cnt;
+    *skip=length.skip;
+    return true;
+}
+void iucountDestroyIntrons(struct IucountIntrons *introns){
+    delete []introns->indices;
+    unmapIntronIndex(&introns->set);
+    delete introns;
+}
+
+/* sorted records are counted as by a single pass over a sorted bam file, the pending reads of a chromosome
+ * being counted once the next one comes in. Records in any order are counted one by one */
+template<class L> int pushRecords(struct IucountCounter *context, bam1_t *const *records, size_t n){
+    auto pending=(struct Pending<L>*)context->pending;
+    auto counter=&context->counter;
+    bool fragment=context->options.fragment;
+    if (context->failed) return -1;
+    for (size_t i=0; i<n; ++i){
+        bam1_t *b=records[i];
+        int tid=b->core.tid;
+        if (tid<0 || tid>=(int)context->targets.size()) continue;
+        auto index=context->targets[tid];
+        if (!context->options.sorted){
+            ++counter->readCount;
+            if (fragment) pending->namePairer.add(b, index, counter);
+            else countRead<L>(b, index, counter);
+            continue;
+        }
+        if (tid!=context->chromId){
+            if (context->visited[tid]){
+                cerr<<"[error] unsorted records at "<<getName(b)<<endl;
+                context->failed=true;
+                return -1;
+            }
+            pending->collapser.flush(counter);
+            pending->matePairer.flush(counter);
+            context->chromId=tid;
+            context->visited[tid]=true;
+            context->lastPosition=0;
+        }
+        if (context->lastPosition>getPosition(b)){
+            cerr<<"[error] unsorted records at "<<getName(b)<<endl;
+            context->failed=true;
+            return -1;
+        }
+        context->lastPosition=getPosition(b);
+        ++counter->readCount;
+        if (fragment) pending->matePairer.add(b, index, counter);
+        else pending->collapser.add(b, index, counter);
+    }
+    return 0;
+}
+template<class L> void finishRecords(struct IucountCounter *context){
+    auto pending=(struct Pending<L>*)context->pending;
+    auto counter=&context->counter;
+    pending->collapser.flush(counter);
+    pending->matePairer.flush(counter);
+    pending->namePairer.flush(counter);
+    countSegments<L::stats>(counter);
+    context->chromId=-1;
+    context->failed=false;
+    context->visited.assign(context->visited.size(), false);
+    context->lastPosition=0;
+}
+template<class L> void releaseRecords(void *pending){
+    delete (struct Pending<L>*)pending;
+}
+template<int libraryType, bool isPaired, bool unique> void selectPush(struct IucountCounter *context){
+    typedef Library<libraryType, isPaired, unique> L;
+    context->push=pushRecords<L>;
+    context->finish=finishRecords<L>;
+    context->release=releaseRecords<L>;
+    context->pending=new struct Pending<L>;
+}
+template<int libraryType> void selectPush(struct IucountCounter *context, bool isPaired, bool unique){
+    if (isPaired) unique?selectPush<libraryType, true, true>(context):selectPush<libraryType, true, false>(context);
+    else unique?selectPush<libraryType, false, true>(context):selectPush<libraryType, false, false>(context);
+}
+
+void iucountInitOptions(struct IucountOptions *options){
+    options->libraryType=IUCOUNT_FR_UNSTRANDED;
+    options->paired=false;
+    options->unique=false;
+    options->fragment=false;
+    options->mateBuffer=1000000;
+    options->span=6;
+    options->sorted=false;
+}
+struct IucountCounter* iucountCreateCounter(const struct IucountIntrons *introns, const sam_hdr_t *header, const struct IucountOptions *options){
+    if (options->libraryType<IUCOUNT_FR_UNSTRANDED || options->libraryType>IUCOUNT_FR_SECONDSTRAND){
+        cerr<<"[error] unknown library type "<<options->libraryType<<endl;
+        return nullptr;
+    }
+    if (options->fragment && !options->paired){
+        cerr<<"[error] fragment mode needs a paired-end library"<<endl;
+        return nullptr;
+    }
+    if (options->span<1 || options->mateBuffer<1){
+        cerr<<"[error] the span and the mate buffer must be positive"<<endl;
+        return nullptr;
+    }
+    struct CountSettings settings;
+    settings.span=options->span;
+    settings.mateBuffer=options->mateBuffer;
+    auto context=new struct IucountCounter(introns, *options, settings);
+    context->targets=indicesByTarget(introns->set, introns->indices, header);
+    context->visited.assign(context->targets.size(), false);
+    if (options->libraryType==FRFIRSTSTRAND) selectPush<FRFIRSTSTRAND>(context, options->paired, options->unique);
+    else if (options->libraryType==FRSECONDSTRAND) selectPush<FRSECONDSTRAND>(context, options->paired, options->unique);
+    else selectPush<FRUNSTRANDED>(context, options->paired, options->unique);
+    return context;
+}
+int iucountPush(struct IucountCounter *counter, bam1_t *const *records, size_t n){
+    return counter->push(counter, records, n);
+}
+void iucountFinish(struct IucountCounter *counter){
+    counter->finish(counter);
+}
+struct IucountCounts iucountCounts(const struct IucountCounter *counter){
+    auto &counts=counter->counter;
+    return {counts.incCount.data(), counts.cntCount.data(), counts.skipCount.data(), counts.incCount.size()};
+}
+uint64_t iucountRecords(const struct IucountCounter *counter){
+    return counter->counter.readCount;
+}
+bool iucountMerge(struct IucountCounter *to, const struct IucountCounter *from){
+    if (to->introns!=from->introns) return false;
+    auto introns=to->introns;
+    for (uint32_t i=0; i<introns->set.chromCount; ++i)
+        to->counter.mergeIntrons(from->counter, introns->indices[i].ids, introns->indices[i].n);
+    to->counter.mergeTotals(from->counter);
+    return true;
+}
+void iucountDestroyCounter(struct IucountCounter *counter){
+    delete counter;
+}
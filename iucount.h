@@ -0,0 +1,115 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* libiucount: intron usage counting for programs that already decode the records. The introns are loaded
+ * once and shared read only by any number of counters, each counting the records pushed to it on its own,
+ * so that counters can count in parallel threads. Nothing here exits the process or uses global state,
+ * errors are returned and described on standard error. The interface is plain C, callable from C and C++.
+ *
+ *     struct IucountIntrons *introns=iucountLoadIntrons("introns.txt");
+ *     struct IucountOptions options;
+ *     iucountInitOptions(&options);
+ *     options.libraryType=IUCOUNT_FR_FIRSTSTRAND;
+ *     struct IucountCounter *counter=iucountCreateCounter(introns, header, &options);
+ *     while (...) iucountPush(counter, records, n);
+ *     iucountFinish(counter);
+ *     struct IucountCounts counts=iucountCounts(counter);
+ */
+
+#ifndef IUCOUNT_IUCOUNT_H
+#define IUCOUNT_IUCOUNT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <htslib/sam.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IUCOUNT_FR_UNSTRANDED 0
+#define IUCOUNT_FR_FIRSTSTRAND 1
+#define IUCOUNT_FR_SECONDSTRAND 2
+
+//set to their defaults by iucountInitOptions
+struct IucountOptions{
+    int libraryType; //IUCOUNT_FR_UNSTRANDED
+    bool paired; //false
+    bool unique; //only records with NH:1, false
+    bool fragment; //count the mates of a fragment once, paired only, false
+    size_t mateBuffer; //most mates waiting for their pair in fragment mode, 1000000
+    int span; //minimal span of the segments counting inc and skip, 6
+    /* records are pushed sorted by coordinate, as read from a sorted bam file. Reads sharing the start,
+     * cigar and strand are then counted together, otherwise the records may come in any order. false */
+    bool sorted;
+};
+void iucountInitOptions(struct IucountOptions *options);
+//the counts of a counter, indexed by intron id
+struct IucountCounts{
+    const int *inc;
+    const int *cnt;
+    const int *skip;
+    size_t n;
+};
+struct IucountIntrons;
+struct IucountCounter;
+
+/* the introns of an intron file, a gtf/gff3 annotation or a binary index written by iucount index, in file
+ * order. A binary index is mapped and used in place until the introns are destroyed. Returns nullptr on
+ * failure */
+struct IucountIntrons* iucountLoadIntrons(const char *fn);
+size_t iucountIntronCount(const struct IucountIntrons *introns);
+//the intron of the given id, false if there is none
+bool iucountIntron(const struct IucountIntrons *introns, size_t id, const char **chrom, uint32_t *start, uint32_t *end, char *strand);
+//the number of positions a read can take on the intron to count as inc, cnt and skip
+bool iucountEffectiveLength(const struct IucountIntrons *introns, size_t id, int readLen, int span, int *inc, int *cnt, int *skip);
+//the introns must outlive the counters created with them
+void iucountDestroyIntrons(struct IucountIntrons *introns);
+
+/* a counter of the records of the given header, which is only used to match its chromosomes to those of
+ * the introns. Returns nullptr if the options are not valid */
+struct IucountCounter* iucountCreateCounter(const struct IucountIntrons *introns, const sam_hdr_t *header, const struct IucountOptions *options);
+/* count a batch of records, which are not kept once the call returns. Unmapped records are passed over, and
+ * in fragment mode both mates of a fragment must be pushed to the same counter. With sorted records, returns
+ * -1 at the first record out of order and counts none from it on, every later push also returning -1 until
+ * iucountFinish. Otherwise returns 0 */
+int iucountPush(struct IucountCounter *counter, bam1_t *const *records, size_t n);
+/* count the reads still pending, such as mates waiting for their pair, for the counts to be complete.
+ * Records pushed afterwards start a new pass, which may start over from the first chromosome, and an error
+ * of the pass is cleared */
+void iucountFinish(struct IucountCounter *counter);
+struct IucountCounts iucountCounts(const struct IucountCounter *counter);
+//the records pushed to the counter
+uint64_t iucountRecords(const struct IucountCounter *counter);
+//add the counts of a finished counter of the same introns to those of another, false if the introns differ
+bool iucountMerge(struct IucountCounter *to, const struct IucountCounter *from);
+void iucountDestroyCounter(struct IucountCounter *counter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
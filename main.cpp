@@ -30,26 +30,25 @@
 #include <string.h>
 #include <getopt.h>
 #include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <functional>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include "annotation.h"
 #include "bam.h"
 #include "utility.h"
+#include "count.h"
+#include "parameter.h"
+#include "writer.h"
+#include "checkpoint.h"
 
-struct Parameter{
-    char* intronFile;
-    char* bamFile;
-    char* outFile;
-    bool isPaired;
-    int libraryType;
-    int span;
-    int readLen;
-    bool calculate;
-    bool unique;
-};
 struct Parameter *parameters;
-char * newstr(const char *str){
-    char *cstr=new char[strlen(str)+1];
-    strcpy(cstr, str);
-    return cstr;
-}
+
 char ** split(char * line, char ** results, int length,char c='\t'){
     char *start=line;
     char *end=nullptr;
@@ -68,218 +67,979 @@ char ** split(char * line, char ** results, int length,char c='\t'){
     return results;
 }
 using namespace std;
-struct Intron{
-    char* chrom;
-    uint32_t chromStart;
-    uint32_t chromEnd;
-    char strand;
-    int incCount=0;
-    int cntCount=0;
-    int skipCount=0;
+/* a chromosome or a part of it, visiting the intron regions starting within [start, end). A read is
+ * counted by the task holding the first region it overlaps */
+struct Task{
+    int chromId;
+    hts_pos_t start;
+    hts_pos_t end;
+    uint64_t records;
 };
-void readIntrons(vector<struct Intron*> *introns){
-    char line[100000];
-    char *items[8];
-    ifstream infile;
-    infile.open(parameters->intronFile);
-    infile.getline(line, 100000);
-    while (!infile.eof()){
-        if (line[0]!='#'){
-            split(line, items, 8);
-            auto intron=new struct Intron;
-            intron->chrom=newstr(items[0]);
-            intron->chromStart=strtol(items[1], nullptr, 10);
-            intron->chromEnd=strtol(items[2], nullptr, 10);
-            intron->strand=*items[3];
-            introns->push_back(intron);
+
+//the next record, timing its decoding when gathering statistics
+template<class L> bam1_t* nextRecord(bamReader *bam, struct Counter *counter){
+    if (!L::stats) return bam->next();
+    auto start=chrono::steady_clock::now();
+    bam1_t *b=bam->next();
+    counter->stats.decodeSeconds+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    return b;
+}
+template<class L> void countTask(bamReader *bam, const struct Task &task, const struct IntronIndex* index, struct Counter *counter){
+    bam1_t* b;
+    int32_t lastPosition=0;
+    Collapser<L> collapser;
+    MatePairer<L> pairer;
+    /* with an index only the intron regions starting within the range are visited. A read also
+     * overlapping the regions of the previous ranges starts before the end of their last region,
+     * and is counted by the range holding the first region it overlaps */
+    hts_pos_t countFrom=0;
+    auto startTime=chrono::steady_clock::now();
+    if (bam->idx && (parameters->junctionFile || parameters->novelJunctionFile)){
+        //every record starting within the range is read for its junctions, whether or not an intron is near
+        countFrom=task.start;
+        if (bam->seek(task.chromId, task.start, task.end)<0){
+            cerr<<"[error] failed to query the index for "<<bam->header->target_name[task.chromId]<<endl;
+            exit(1);
         }
-        infile.getline(line, 1000000);
     }
-    infile.close();
+    else if (bam->idx){
+        auto regions=index->regions;
+        auto before=[](const pair<int32_t, int32_t> &region, hts_pos_t position){return region.first<position;};
+        auto first=lower_bound(regions, regions+index->regionCount, task.start, before);
+        auto last=lower_bound(first, regions+index->regionCount, task.end, before);
+        if (first==last) return;
+        if (first!=regions) countFrom=prev(first)->second;
+        if (bam->seek(task.chromId, first, last)<0){
+            cerr<<"[error] failed to query the index for "<<bam->header->target_name[task.chromId]<<endl;
+            exit(1);
+        }
+    }
+    else bam->seek(task.chromId);
+    while ((b=nextRecord<L>(bam, counter))!=nullptr && b->core.tid==task.chromId){
+        if (getPosition(b)<countFrom) continue;
+        if (lastPosition>getPosition(b)){
+            cerr<<"[error] unsorted bam at "<<getName(b)<<endl;
+            exit(12);
+        }
+        lastPosition=getPosition(b);
+        ++counter->readCount;
+        if (L::stats) counter->stats.records++;
+        if (parameters->fragment) pairer.add(b, index, counter);
+        else collapser.add(b, index, counter);
+    }
+    collapser.flush(counter);
+    pairer.flush(counter);
+    if (L::stats) counter->closeChrom(task.chromId, chrono::duration<double>(chrono::steady_clock::now()-startTime).count());
+}
+//guards progress messages of concurrent workers
+mutex logLock;
+/* single pass over the records in file order, without any seek. done is called with each chromosome once
+ * its reads are counted */
+template<class L> void countStream(bamReader *bam, const vector<const struct IntronIndex*> &targets, const string &label, struct Counter *counter, const function<void(int)> &done){
+    bam1_t* b;
+    int chromId=-2;
+    int32_t lastPosition=0;
+    Collapser<L> collapser;
+    MatePairer<L> pairer;
+    auto visited=new bool[bam->header->n_targets]();
+    auto startTime=chrono::steady_clock::now();
+    //the pending reads are counted at the end of each chromosome, for its counts and statistics to be complete
+    auto closeChrom=[&](){
+        collapser.flush(counter);
+        pairer.flush(counter);
+        if (L::stats){
+            auto now=chrono::steady_clock::now();
+            counter->closeChrom(chromId, chrono::duration<double>(now-startTime).count());
+            startTime=now;
+        }
+        done(chromId);
+    };
+    while ((b=nextRecord<L>(bam, counter))!=nullptr){
+        if (b->core.tid<0){ //unplaced reads must come last
+            if (chromId>=0) closeChrom();
+            chromId=-1;
+            continue;
+        }
+        if (b->core.tid!=chromId){
+            if (visited[b->core.tid] || chromId==-1){
+                cerr<<"[error] unsorted bam at "<<getName(b)<<endl;
+                exit(12);
+            }
+            if (chromId>=0) closeChrom();
+            chromId=b->core.tid;
+            visited[chromId]=true;
+            lastPosition=0;
+            lock_guard<mutex> lock(logLock);
+            cerr<<"processing "<<label<<bam->header->target_name[chromId]<<endl;
+        }
+        if (lastPosition>getPosition(b)){
+            cerr<<"[error] unsorted bam at "<<getName(b)<<endl;
+            exit(12);
+        }
+        lastPosition=getPosition(b);
+        ++counter->readCount;
+        if (L::stats) counter->stats.records++;
+        if (parameters->fragment) pairer.add(b, targets[chromId], counter);
+        else collapser.add(b, targets[chromId], counter);
+    }
+    if (chromId>=0) closeChrom();
+    delete []visited;
+}
+/* single pass over unsorted or name sorted records. The segments of a read are looked up in the index of
+ * its chromosome whatever their position, so the reads are counted one by one as they come, and mates
+ * are paired by name in fragment mode. done is called with every chromosome at the end */
+template<class L> void countUnsorted(bamReader *bam, const vector<const struct IntronIndex*> &targets, const string &label, struct Counter *counter, const function<void(int)> &done){
+    bam1_t* b;
+    int chromId=-1;
+    NamePairer<L> pairer;
+    auto startTime=chrono::steady_clock::now();
+    {
+        lock_guard<mutex> lock(logLock);
+        cerr<<"processing "<<label<<"unsorted records"<<endl;
+    }
+    while ((b=nextRecord<L>(bam, counter))!=nullptr){
+        if (b->core.tid<0) continue;
+        //statistics go to the chromosome of the records read since the last change of chromosome
+        if (L::stats && b->core.tid!=chromId){
+            auto now=chrono::steady_clock::now();
+            if (chromId>=0) counter->closeChrom(chromId, chrono::duration<double>(now-startTime).count());
+            startTime=now;
+            chromId=b->core.tid;
+        }
+        ++counter->readCount;
+        if (L::stats) counter->stats.records++;
+        if (parameters->fragment) pairer.add(b, targets[b->core.tid], counter);
+        else countRead<L>(b, targets[b->core.tid], counter);
+    }
+    pairer.flush(counter);
+    countSegments<L::stats>(counter);
+    if (L::stats && chromId>=0) counter->closeChrom(chromId, chrono::duration<double>(chrono::steady_clock::now()-startTime).count());
+    for (int i=0; i<bam->header->n_targets; ++i) done(i);
+}
+//the counting loops instantiated for the library settings of the run
+struct Kernel{
+    void (*task)(bamReader*, const struct Task&, const struct IntronIndex*, struct Counter*);
+    void (*stream)(bamReader*, const vector<const struct IntronIndex*>&, const string&, struct Counter*, const function<void(int)>&);
+    void (*unsorted)(bamReader*, const vector<const struct IntronIndex*>&, const string&, struct Counter*, const function<void(int)>&);
 };
-void deleteIntron(struct Intron* intron){
-    delete [] intron->chrom;
-    delete intron;
+template<int libraryType, bool isPaired, bool unique> struct Kernel selectKernel(bool stats){
+    typedef Library<libraryType, isPaired, unique, true> Gathering;
+    typedef Library<libraryType, isPaired, unique, false> Plain;
+    if (stats) return {countTask<Gathering>, countStream<Gathering>, countUnsorted<Gathering>};
+    return {countTask<Plain>, countStream<Plain>, countUnsorted<Plain>};
 }
-void deleteIntrons(vector<struct Intron*> *introns){
-    for (auto intron: *introns) deleteIntron(intron);
+template<int libraryType> struct Kernel selectKernel(bool isPaired, bool unique, bool stats){
+    if (isPaired) return unique?selectKernel<libraryType, true, true>(stats):selectKernel<libraryType, true, false>(stats);
+    return unique?selectKernel<libraryType, false, true>(stats):selectKernel<libraryType, false, false>(stats);
 }
-
-bool compare(struct Intron* i, struct Intron* j){
-    return i->chromStart<j->chromStart;
+struct Kernel selectKernel(){
+    bool stats=parameters->statsFile!=nullptr;
+    if (parameters->libraryType==FRFIRSTSTRAND) return selectKernel<FRFIRSTSTRAND>(parameters->isPaired, parameters->unique, stats);
+    if (parameters->libraryType==FRSECONDSTRAND) return selectKernel<FRSECONDSTRAND>(parameters->isPaired, parameters->unique, stats);
+    return selectKernel<FRUNSTRANDED>(parameters->isPaired, parameters->unique, stats);
+}
+//whether the chromosome is counted, all of them unless given with --chroms
+bool selectedChrom(const string &name){
+    auto &chroms=parameters->chroms;
+    return chroms.empty() || find(chroms.begin(), chroms.end(), name)!=chroms.end();
 }
-int countInc(int32_t chromStart, int32_t chromEnd, char strand, vector<struct Intron*>* index, int guide, unordered_map<struct Intron *,int>* incRecorder, unordered_map<struct Intron *,int>* cntRecorder){
-    int i=guide;
-    int32_t overlap, leftSpan, rightSpan;
-    while(i<index->size() && (*index)[i]->chromEnd<=chromStart) ++i;
-    guide=i;
-    while(i<index->size() && (*index)[i]->chromStart<chromEnd){
-        struct Intron* intron=(*index)[i];
-        if (strand == '.' || strand == (*index)[i]->strand){
-            //an overlap less than zero mean there is no overlap
-            overlap=min((int32_t)intron->chromEnd, chromEnd)-max((int32_t)intron->chromStart, chromStart);
-            if (overlap>=parameters->span){
-                leftSpan=(int32_t)intron->chromStart-chromStart;
-                rightSpan=chromEnd-(int32_t)intron->chromEnd;
-                if (leftSpan>=parameters->span || rightSpan>=parameters->span) (*incRecorder)[intron]=1;
-                if (leftSpan<=0 && rightSpan<=0) (*cntRecorder)[intron]=1;
+/* one task per chromosome holding introns, or with --junctions per chromosome counted, in file order.
+ * With several workers, chromosomes holding much more than an even share of the records are split into
+ * ranges, and the tasks are sorted largest first so that the biggest chromosome does not decide the total
+ * runtime. Without record counts in the index, as for cram, the lengths of the chromosomes are used
+ * instead. Chromosomes are not split in fragment mode, which needs both mates in the same task */
+vector<struct Task> planTasks(bamReader *bam, const vector<const struct IntronIndex*> &targets, int workers){
+    vector<struct Task> tasks;
+    vector<int> chroms;
+    for (auto chromId: bam->chroms)
+        if (targets[chromId]->regionCount>0 || ((parameters->junctionFile || parameters->novelJunctionFile) && selectedChrom(bam->header->target_name[chromId]))) chroms.push_back(chromId);
+    uint64_t total=0;
+    for (auto chromId: chroms) total+=bam->records(chromId);
+    bool counted=total>0;
+    if (!counted) for (auto chromId: chroms) total+=bam->header->target_len[chromId];
+    uint64_t share=total/(workers*4)+1;
+    for (auto chromId: chroms){
+        hts_pos_t length=bam->header->target_len[chromId];
+        uint64_t records=counted?bam->records(chromId):length;
+        hts_pos_t pieces=1;
+        if (workers>1 && bam->idx && !parameters->fragment) pieces=max(min((hts_pos_t)((records+share-1)/share), length/1000000), (hts_pos_t)1);
+        hts_pos_t step=length/pieces+1;
+        for (hts_pos_t i=0; i<pieces; ++i)
+            tasks.push_back({chromId, i*step, i==pieces-1?HTS_POS_MAX:(i+1)*step, records/pieces});
+    }
+    if (workers>1) stable_sort(tasks.begin(), tasks.end(), [](const struct Task &i, const struct Task &j){return i.records>j.records;});
+    return tasks;
+}
+//hash of the settings the counts depend on, checkpoints are only restored by runs of the same settings
+uint64_t checkpointSettings(){
+    uint64_t h=0xcbf29ce484222325ull;
+    for (uint64_t value: {(uint64_t)parameters->libraryType, (uint64_t)parameters->isPaired, (uint64_t)parameters->unique, (uint64_t)parameters->fragment, (uint64_t)parameters->span})
+        h=(h^value)*0x100000001b3ull;
+    return h;
+}
+/* --junctions: the junctions of each chromosome of each sample, written as soon as the chromosome is counted,
+ * so that chromosomes come in the order they complete. The compressed file of several samples is indexed by
+ * tabix, which needs the lines of a chromosome together and sorted by start: those are gathered until every
+ * sample has counted the chromosome, or until the file is closed. Junctions matching an intron of the same strand, or of
+ * any strand for unstranded reads, are annotated, the others novel.
+ * --novel-junctions: the novel junctions of every sample, gathered and written as an intron file once all
+ * are counted, each once per strand. An intron of strand '.' never has skip counts, so unstranded junctions
+ * take the strand of most of the stranded reads of the same junction, or else that of the introns sharing
+ * their start or end, and are written on both strands when neither tells */
+struct JunctionWriter{
+    struct ResultWriter writer, novelWriter;
+    bool all=false, novel=false; //whether each file is written
+    bool named; //the sample of each junction is written when there are several samples
+    vector<string> novelChroms; //in the order they are first counted
+    unordered_map<string, vector<pair<uint64_t, char>>> novelJunctions;
+    struct Line{
+        struct JunctionTable::Entry junction;
+        bool annotated;
+        const string *sample;
+    };
+    struct Gathered{
+        size_t samples=0; //the samples which counted the chromosome
+        vector<struct Line> lines;
+    };
+    size_t sampleCount;
+    bool gather=false;
+    vector<string> gatheredChroms; //in the order they are first counted
+    unordered_map<string, struct Gathered> gathered;
+    mutex lock;
+    bool open(const char *fn, const vector<struct Sample> &samples, int threads){
+        if (!writer.open(fn, threads)) return false;
+        all=true;
+        named=samples.size()>1;
+        sampleCount=samples.size();
+        gather=named && writer.compressed();
+        writer.append(string("#chrom\tstart\tend\tstrand\treads\tanchor\tstatus")+(named?"\tsample\n":"\n"));
+        return true;
+    }
+    void writeLine(const char *chrom, const struct Line &line){
+        writer.append(chrom);
+        writer.appendChar('\t');
+        writer.appendInteger(line.junction.key>>32);
+        writer.appendChar('\t');
+        writer.appendInteger((uint32_t)line.junction.key);
+        writer.appendChar('\t');
+        writer.appendChar(line.junction.strand);
+        writer.appendChar('\t');
+        writer.appendInteger(line.junction.reads);
+        writer.appendChar('\t');
+        writer.appendInteger(line.junction.anchor);
+        writer.append(line.annotated?"\tannotated":"\tnovel");
+        if (named){
+            writer.appendChar('\t');
+            writer.append(*line.sample);
+        }
+        writer.appendChar('\n');
+    }
+    //the gathered lines of a chromosome sorted by start and end, those of a junction in the order the samples counted it
+    void writeGathered(const string &chrom){
+        auto &lines=gathered[chrom].lines;
+        stable_sort(lines.begin(), lines.end(), [](const struct Line &i, const struct Line &j){return i.junction.key<j.junction.key;});
+        for (auto &line: lines) writeLine(chrom.c_str(), line);
+        vector<struct Line>().swap(lines);
+    }
+    bool openNovel(const char *fn, int threads){
+        return novel=novelWriter.open(fn, threads);
+    }
+    //the strand of the introns starting and ending at each position of a chromosome, '.' where they differ
+    struct Sites{
+        bool built=false;
+        unordered_map<int32_t, char> starts, ends;
+        void build(const struct IntronIndex *index){
+            built=true;
+            for (int32_t i=0; i<index->n; ++i){
+                char strand=index->strands[i];
+                if (strand!='+' && strand!='-') continue;
+                auto it=starts.emplace(index->starts[i], strand).first;
+                if (it->second!=strand) it->second='.';
+                it=ends.emplace(index->ends[i], strand).first;
+                if (it->second!=strand) it->second='.';
+            }
+        }
+    };
+    //the strand of an unstranded novel junction, 0 if unknown
+    static char inferStrand(const vector<struct JunctionTable::Entry> &junctions, size_t j, const struct IntronIndex *index, struct Sites *sites){
+        //the stranded entries of a junction come right before its unstranded one
+        int64_t plus=0, minus=0;
+        for (size_t k=j; k>0 && junctions[k-1].key==junctions[j].key; --k)
+            (junctions[k-1].strand=='+'?plus:minus)+=junctions[k-1].reads;
+        if (plus!=minus) return plus>minus?'+':'-';
+        if (!sites->built) sites->build(index);
+        auto start=sites->starts.find(junctions[j].key>>32);
+        auto end=sites->ends.find((uint32_t)junctions[j].key);
+        char startStrand=start==sites->starts.end()?0:start->second, endStrand=end==sites->ends.end()?0:end->second;
+        if (startStrand=='.' || endStrand=='.' || (startStrand && endStrand && startStrand!=endStrand)) return 0;
+        return startStrand?startStrand:endStrand;
+    }
+    void write(const string &sample, const char *chrom, const vector<struct JunctionTable::Entry> &junctions, const struct IntronIndex *index){
+        lock_guard<mutex> guard(lock);
+        vector<pair<uint64_t, char>> *found=nullptr;
+        if (novel){
+            auto it=novelJunctions.find(chrom);
+            if (it==novelJunctions.end()){
+                novelChroms.emplace_back(chrom);
+                it=novelJunctions.emplace(chrom, vector<pair<uint64_t, char>>()).first;
+            }
+            found=&it->second;
+        }
+        struct Gathered *lines=nullptr;
+        if (gather){
+            auto it=gathered.find(chrom);
+            if (it==gathered.end()){
+                gatheredChroms.emplace_back(chrom);
+                it=gathered.emplace(chrom, Gathered()).first;
+            }
+            lines=&it->second;
+        }
+        struct Sites sites;
+        for (size_t j=0; j<junctions.size(); ++j){
+            auto &junction=junctions[j];
+            int32_t start=junction.key>>32, end=(uint32_t)junction.key;
+            bool annotated=(junction.strand!='-' && index->junction(junctionKey(start, end))>=0) ||
+                           (junction.strand!='+' && index->junction(junctionKey(end, start))>=0);
+            if (found && !annotated){
+                char strand=junction.strand=='.'?inferStrand(junctions, j, index, &sites):junction.strand;
+                if (strand!='-') found->emplace_back(junction.key, strand?strand:'+');
+                if (strand!='+') found->emplace_back(junction.key, strand?strand:'-');
+            }
+            if (lines) lines->lines.push_back({junction, annotated, &sample});
+            else if (all) writeLine(chrom, {junction, annotated, &sample});
+        }
+        if (lines && ++lines->samples==sampleCount) writeGathered(chrom);
+    }
+    //the chromosomes some sample did not count are written last
+    bool close(){
+        for (auto &chrom: gatheredChroms) if (!gathered[chrom].lines.empty()) writeGathered(chrom);
+        return writer.close();
+    }
+    //the novel junctions of a chromosome sorted by start, end and strand, once for all samples
+    bool closeNovel(){
+        for (auto &chrom: novelChroms){
+            auto &junctions=novelJunctions[chrom];
+            sort(junctions.begin(), junctions.end());
+            junctions.erase(unique(junctions.begin(), junctions.end()), junctions.end());
+            for (auto &junction: junctions){
+                novelWriter.append(chrom);
+                novelWriter.appendChar('\t');
+                novelWriter.appendInteger(junction.first>>32);
+                novelWriter.appendChar('\t');
+                novelWriter.appendInteger((uint32_t)junction.first);
+                novelWriter.appendChar('\t');
+                novelWriter.appendChar(junction.second);
+                novelWriter.appendChar('\n');
+            }
+        }
+        return novelWriter.close();
+    }
+};
+/* count one bam file with the given number of threads. An indexed bam file is counted by one worker per
+ * thread, each decoding its own chromosomes, otherwise the threads are used to decompress the single
+ * stream of records. done is called with each chromosome of the introns and the counter holding its
+ * counts once they are complete, possibly from several threads */
+struct Counter* countSample(const struct Sample &sample, const struct IntronSet *introns, const struct IntronIndex *indices, int threads, const function<void(int, const struct Counter*)> &done, struct JunctionWriter *junctionWriter){
+    const char *bamFile=sample.bamFile.c_str();
+    auto kernel=selectKernel();
+    struct CountSettings settings;
+    settings.span=parameters->span;
+    settings.mateBuffer=parameters->mateBuffer;
+    settings.barcodeTag=parameters->barcodeTag;
+    settings.umiTag=parameters->umiTag;
+    //the sample is named in progress messages when several are counted
+    string label=parameters->samples.size()>1?sample.name+' ':"";
+    /* the chromosomes left out by --chroms, and with --checkpoint those restored from an earlier run, are
+     * not counted. The checkpoints of a sample restored entirely are merged without its bam file, which is
+     * otherwise the one they were written from */
+    vector<struct Counter*> counters{new struct Counter(introns->size(), settings)};
+    vector<char> reported(introns->chromCount);
+    vector<pair<size_t, struct CheckpointInput>> written; //the chromosomes restored and their bam file
+    size_t restored=0, skipped=0;
+    for (size_t c=0; c<reported.size(); ++c){
+        if (!selectedChrom(introns->chromName(c))) reported[c]=true;
+        else if (parameters->checkpointDir){
+            struct CheckpointInput from;
+            int ret=readCheckpoint(checkpointName(parameters->checkpointDir, sample.name, introns->chromName(c)), checkpointSettings(), indices[c], counters[0], &from);
+            if (ret<0) exit(1);
+            if (ret>0) reported[c]=true, ++restored, written.push_back({c, from});
+        }
+        if (reported[c]) ++skipped;
+    }
+    struct CheckpointInput input={};
+    if (parameters->checkpointDir && skipped<reported.size()){
+        if (!checkpointInput(bamFile, &input)){
+            cerr<<"[error] failed to stat "<<bamFile<<endl;
+            exit(1);
+        }
+        for (auto &checkpoint: written)
+            if (!sameInput(checkpointName(parameters->checkpointDir, sample.name, introns->chromName(checkpoint.first)), checkpoint.second, input)) exit(1);
+    }
+    for (size_t c=0; c<reported.size(); ++c) if (reported[c]) done(c, counters[0]);
+    if (restored){
+        lock_guard<mutex> lock(logLock);
+        cerr<<label<<"restored "<<restored<<" chromosomes from checkpoints"<<endl;
+    }
+    if (skipped==reported.size() && !junctionWriter) return counters[0];
+    /* only the fields used for counting are decoded from cram files: the name for messages, the flag,
+     * the position, the cigar, the mate position in fragment mode and, for unique alignments, barcodes or the
+     * strand of junctions, the tags */
+    int fields=SAM_QNAME|SAM_FLAG|SAM_RNAME|SAM_POS|SAM_CIGAR;
+    if (parameters->fragment) fields|=SAM_RNEXT|SAM_PNEXT;
+    if (parameters->unique || parameters->barcodeTag || junctionWriter) fields|=SAM_AUX;
+    auto openReader=[&](bamReader *reader){
+        if (!reader->open(bamFile)) exit(1);
+        if ((parameters->reference && !reader->setReference(parameters->reference)) || !reader->setRequiredFields(fields)){
+            cerr<<"[error] failed to set up decoding of "<<bamFile<<endl;
+            exit(1);
+        }
+    };
+    bamReader bam;
+    openReader(&bam);
+    bool stream=parameters->stream || parameters->unsorted;
+    if (!stream && !bam.loadIndex(bamFile)){
+        lock_guard<mutex> lock(logLock);
+        if (bam.isBam()) cerr<<"[warning] bam index not found for "<<bamFile<<", scanning the whole bam file"<<endl;
+        else {
+            cerr<<"[warning] index not found for "<<bamFile<<", reading it in a single pass"<<endl;
+            stream=true;
+        }
+    }
+    if (!stream && !bam.idx && !bam.parse()) exit(1);
+    int workers=1;
+    hts_tpool *pool=nullptr;
+    if (bam.idx) workers=max(threads, 1);
+    else if (threads>1){
+        pool=hts_tpool_init(threads);
+        if (!pool || !bam.attachThreadPool(pool, threads*2)){
+            cerr<<"[error] failed to set up "<<threads<<" decompression threads"<<endl;
+            exit(1);
+        }
+    }
+
+    //find the introns of each chromosome of the bam file
+    vector<const struct IntronIndex*> targets;
+    {
+        lock_guard<mutex> lock(logLock);
+        targets=indicesByTarget(*introns, indices, bam.header);
+    }
+
+    //the chromosome of the introns of each chromosome of the bam file
+    vector<int> chromOf(bam.header->n_targets, -1);
+    for (int i=0; i<bam.header->n_targets; ++i){
+        chromOf[i]=introns->chromId(bam.header->target_name[i]);
+    }
+    //the chromosomes not counted have no introns, their records are passed over and not even read with an index
+    static const struct IntronIndex noIntrons;
+    for (int i=0; i<bam.header->n_targets; ++i) if (chromOf[i]>=0 && reported[chromOf[i]]) targets[i]=&noIntrons;
+    //the counts of a chromosome are saved once complete with --checkpoint
+    auto save=[&](int chrom){
+        if (!parameters->checkpointDir) return;
+        auto fn=checkpointName(parameters->checkpointDir, sample.name, introns->chromName(chrom));
+        if (!writeCheckpoint(fn, checkpointSettings(), input, indices[chrom], *counters[0])){
+            lock_guard<mutex> lock(logLock);
+            cerr<<"[warning] failed to write checkpoint "<<fn<<endl;
+        }
+    };
+    if (junctionWriter) counters[0]->junctions=new struct Junctions(bam.header->n_targets);
+    //the junctions of a chromosome, tallied by every worker, are written once it is counted
+    auto writeJunctions=[&](int chromId){
+        if (!junctionWriter) return;
+        auto &table=counters[0]->junctions->tables[chromId];
+        for (size_t w=1; w<counters.size(); ++w){
+            table.merge(counters[w]->junctions->tables[chromId]);
+            counters[w]->junctions->tables[chromId].clear();
+        }
+        auto junctions=table.take();
+        if (selectedChrom(bam.header->target_name[chromId])) junctionWriter->write(sample.name, bam.header->target_name[chromId], junctions, targets[chromId]);
+    };
+    auto report=[&](int chromId){
+        writeJunctions(chromId);
+        if (chromOf[chromId]<0 || reported[chromOf[chromId]]) return;
+        reported[chromOf[chromId]]=true;
+        save(chromOf[chromId]);
+        done(chromOf[chromId], counters[0]);
+    };
+    if (stream){
+        //single pass over the records in file order, without any seek
+        auto counter=counters[0];
+        if (parameters->unsorted) kernel.unsorted(&bam, targets, label, counter, report);
+        else kernel.stream(&bam, targets, label, counter, report);
+    }
+    else {
+        /* every worker holds its own reader and counters, tasks are taken from a shared queue. The worker
+         * finishing the last task of a chromosome merges its counts into those of the first worker */
+        auto tasks=planTasks(&bam, targets, workers);
+        atomic<size_t> nextTask(0);
+        vector<atomic<int>> remaining(bam.header->n_targets);
+        for (auto &left: remaining) left=0;
+        for (auto &task: tasks) ++remaining[task.chromId];
+        for (int w=1; w<workers; ++w){
+            counters.push_back(new struct Counter(introns->size(), settings));
+            if (junctionWriter) counters.back()->junctions=new struct Junctions(bam.header->n_targets);
+        }
+        auto work=[&](int w){
+            bamReader *reader=&bam;
+            if (w>0){
+                reader=new bamReader;
+                openReader(reader);
+                if (!reader->loadIndex(bamFile)) exit(1);
+            }
+            size_t t;
+            while ((t=nextTask++)<tasks.size()){
+                auto &task=tasks[t];
+                {
+                    lock_guard<mutex> lock(logLock);
+                    cerr<<"processing "<<label<<bam.header->target_name[task.chromId];
+                    if (task.start>0 || task.end!=HTS_POS_MAX) cerr<<':'<<task.start+1<<'-'<<min(task.end, (hts_pos_t)bam.header->target_len[task.chromId]);
+                    cerr<<endl;
+                }
+                kernel.task(reader, task, targets[task.chromId], counters[w]);
+                if (--remaining[task.chromId]==0){
+                    auto index=targets[task.chromId];
+                    for (size_t v=1; v<counters.size(); ++v) counters[0]->mergeIntrons(*counters[v], index->ids, index->n);
+                    report(task.chromId);
+                }
             }
+            if (w>0) delete reader;
+        };
+        vector<thread> threads;
+        for (int w=1; w<workers; ++w) threads.emplace_back(work, w);
+        work(0);
+        for (auto &thread: threads) thread.join();
+    }
+    for (size_t w=1; w<counters.size(); ++w){
+        counters[0]->mergeTotals(*counters[w]);
+        delete counters[w];
+    }
+    counters[0]->releaseStamps();
+    if (parameters->umiTag) counters[0]->cells->countUmis();
+    //chromosomes without any read to count
+    for (size_t i=0; i<reported.size(); ++i) if (!reported[i]){
+        save(i);
+        done(i, counters[0]);
+    }
+    if (parameters->fragment){
+        lock_guard<mutex> lock(logLock);
+        cerr<<label<<"at most "<<counters[0]->matePeak<<" mates waited for their pair ("<<(counters[0]->mateBytesPeak>>10)<<" KB)"<<endl;
+        if (counters[0]->mateOverflow) cerr<<"[warning] "<<label<<counters[0]->mateOverflow<<" mates were counted alone as more than "<<parameters->mateBuffer<<" waited for their pair, consider a larger --mate-buffer"<<endl;
+    }
+    //the statistics are written once the header is gone
+    for (size_t i=0; i<counters[0]->chromStats.size(); ++i) counters[0]->chromNames.push_back(bam.header->target_name[i]);
+    bam.close();
+    if (pool) hts_tpool_destroy(pool);
+    return counters[0];
+}
+//a json string, escaping the characters json does not allow as they are
+string jsonString(const string &s){
+    string quoted="\"";
+    char escaped[8];
+    for (unsigned char c: s){
+        if (c=='"' || c=='\\') quoted+='\\';
+        if (c<0x20){
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted+=escaped;
         }
-        ++i;
+        else quoted+=c;
     }
-    return guide;
+    return quoted+'"';
+}
+void writeStatsFields(ostream &out, const struct Stats &stats){
+    double seconds=stats.decodeSeconds+stats.countSeconds;
+    out<<"\"records\": "<<stats.records<<", \"filtered\": "<<stats.filtered<<", \"spliced\": "<<stats.spliced
+       <<", \"intronsTested\": "<<stats.tested<<", \"junctionLookups\": "<<stats.junctionLookups<<", \"junctionHits\": "<<stats.junctionHits
+       <<", \"decodeSeconds\": "<<stats.decodeSeconds<<", \"countSeconds\": "<<stats.countSeconds
+       <<", \"recordsPerSecond\": "<<(uint64_t)(stats.records/max(seconds, 1e-9));
 }
-void countSkip(int32_t chromStart, int32_t chromEnd, int32_t lastChromStart, int32_t lastChromEnd, char strand, unordered_map<uint64_t, struct Intron*>* index){
-    if (lastChromEnd-lastChromStart<=parameters->span || chromEnd-chromStart<=parameters->span) return;
-    unordered_map<uint64_t, struct Intron*>::iterator it;
-    if (strand=='+' || strand=='.'){
-        uint64_t i=((uint64_t)(lastChromEnd)<<32u)+chromStart;
-        it=index->find(i);
-        if (it!=index->end()) it->second->skipCount++;
-    }
-    if (strand=='-' || strand=='.'){
-        uint64_t i=((uint64_t)(chromStart)<<32u)+lastChromEnd;
-        it=index->find(i);
-        if (it!=index->end()) it->second->skipCount++;
+/* the statistics of --stats as json: per sample, in total and per chromosome, and for the whole run the
+ * wall time of counting, the time spent writing the output, mostly while counting, and the peak resident
+ * memory. The seconds of decoding and counting are summed over the workers of a sample */
+void writeStats(const vector<struct Counter*> &counters, const vector<double> &sampleSeconds, double countSeconds, double outputSeconds, int threads){
+    ofstream out(parameters->statsFile);
+    if (!out){
+        cerr<<"[error] failed to write statistics to "<<parameters->statsFile<<endl;
+        exit(1);
+    }
+    out.precision(6);
+    struct Stats total;
+    uint64_t readCount=0;
+    out<<"{\n  \"samples\": [";
+    for (size_t s=0; s<counters.size(); ++s){
+        auto counter=counters[s];
+        struct Stats sample;
+        for (auto &stats: counter->chromStats) sample.add(stats);
+        total.add(sample);
+        readCount+=counter->readCount;
+        out<<(s?",":"")<<"\n    {\"name\": "<<jsonString(parameters->samples[s].name)<<", \"file\": "<<jsonString(parameters->samples[s].bamFile)
+           <<", \"seconds\": "<<sampleSeconds[s]<<",\n     \"total\": {";
+        writeStatsFields(out, sample);
+        out<<"},\n     \"chromosomes\": {";
+        bool first=true;
+        for (size_t i=0; i<counter->chromStats.size(); ++i){
+            if (counter->chromStats[i].records==0) continue;
+            out<<(first?"":",")<<"\n       "<<jsonString(counter->chromNames[i])<<": {";
+            writeStatsFields(out, counter->chromStats[i]);
+            out<<"}";
+            first=false;
+        }
+        out<<"}}";
     }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    out<<"\n  ],\n  \"total\": {";
+    writeStatsFields(out, total);
+    out<<"},\n  \"threads\": "<<threads<<", \"countingSeconds\": "<<countSeconds<<", \"outputSeconds\": "<<outputSeconds
+       <<", \"readsPerSecond\": "<<(uint64_t)(readCount/max(countSeconds, 1e-9))<<", \"peakRssKB\": "<<usage.ru_maxrss<<"\n}\n";
+    out.close();
+}
+/* the rows of the counts, written chromosome by chromosome in the order of the intron file, each as soon
+ * as it and those before it are counted in every sample. Rows of a chromosome are in file order, and sorted
+ * by start in compressed output for tabix */
+struct RowWriter{
+    struct ResultWriter writer;
+    const struct IntronSet *introns;
+    vector<vector<uint32_t>> rows;
+    vector<const struct Counter*> counters;
+    vector<size_t> pending; //samples still counting each chromosome
+    size_t next=0;
+    double seconds=0;
+    mutex lock;
+    bool open(const char *fn, const struct IntronSet *introns, const vector<struct Sample> &samples, int threads){
+        if (!writer.open(fn, threads)) return false;
+        this->introns=introns;
+        rows.resize(introns->chromCount);
+        for (uint32_t i=0; i<introns->size(); ++i) rows[introns->chroms[i]].push_back(i);
+        for (size_t c=0; c<rows.size(); ++c) if (!selectedChrom(introns->chromName(c))) rows[c].clear();
+        if (writer.compressed())
+            for (auto &ids: rows) stable_sort(ids.begin(), ids.end(), [&](uint32_t i, uint32_t j){
+                return introns->starts[i]<introns->starts[j] || (introns->starts[i]==introns->starts[j] && introns->ends[i]<introns->ends[j]);
+            });
+        counters.resize(samples.size());
+        pending.assign(rows.size(), samples.size());
+        //one column each of inc, cnt and skip per sample, named in a header line when there are several samples
+        if (samples.size()>1){
+            writer.append(string("#chrom\tstart\tend\tstrand"));
+            for (auto &sample: samples) writer.append('\t'+sample.name+".inc\t"+sample.name+".cnt\t"+sample.name+".skip");
+            writer.appendChar('\n');
+        }
+        return true;
+    }
+    void done(size_t sample, int chrom, const struct Counter *counter){
+        lock_guard<mutex> guard(lock);
+        counters[sample]=counter;
+        if (--pending[chrom]>0) return;
+        auto start=chrono::steady_clock::now();
+        while (next<rows.size() && pending[next]==0) write(next++);
+        seconds+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    }
+    void write(size_t chrom){
+        const char *name=introns->chromName(chrom);
+        for (auto i: rows[chrom]){
+            writer.append(name);
+            writer.appendChar('\t');
+            writer.appendInteger(introns->starts[i]);
+            writer.appendChar('\t');
+            writer.appendInteger(introns->ends[i]);
+            writer.appendChar('\t');
+            writer.appendChar(introns->strands[i]);
+            for (auto counter: counters){
+                writer.appendChar('\t');
+                writer.appendInteger(counter->incCount[i]);
+                writer.appendChar('\t');
+                writer.appendInteger(counter->cntCount[i]);
+                writer.appendChar('\t');
+                writer.appendInteger(counter->skipCount[i]);
+            }
+            writer.appendChar('\n');
+        }
+    }
+    bool close(){
+        auto start=chrono::steady_clock::now();
+        bool closed=writer.close();
+        seconds+=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        return closed;
+    }
+};
+/* the counts of barcode mode as matrix market files of introns by cells, one per kind of count, with the
+ * rows named in <prefix>.introns.tsv and the columns in <prefix>.barcodes.tsv. The cells of a sample are
+ * sorted by barcode, and named sample_barcode when there are several samples */
+bool writeMatrix(const string &prefix, const struct IntronSet &introns, const vector<struct Counter*> &counters, const vector<struct Sample> &samples){
+    struct ResultWriter writer;
+    if (!writer.open((prefix+".introns.tsv").c_str(), 1)) return false;
+    for (uint32_t i=0; i<introns.size(); ++i){
+        writer.append(introns.chromName(introns.chroms[i]));
+        writer.appendChar('\t');
+        writer.appendInteger(introns.starts[i]);
+        writer.appendChar('\t');
+        writer.appendInteger(introns.ends[i]);
+        writer.appendChar('\t');
+        writer.appendChar(introns.strands[i]);
+        writer.appendChar('\n');
+    }
+    if (!writer.close()) return false;
+
+    //the column of each cell of each sample
+    vector<vector<uint32_t>> columns(counters.size());
+    uint32_t nColumns=0;
+    if (!writer.open((prefix+".barcodes.tsv").c_str(), 1)) return false;
+    for (size_t s=0; s<counters.size(); ++s){
+        auto &barcodes=counters[s]->cells->barcodes;
+        vector<uint32_t> order(barcodes.size());
+        for (uint32_t i=0; i<order.size(); ++i) order[i]=i;
+        sort(order.begin(), order.end(), [&](uint32_t i, uint32_t j){return barcodes[i]<barcodes[j];});
+        columns[s].resize(barcodes.size());
+        for (auto cell: order){
+            columns[s][cell]=nColumns++;
+            if (counters.size()>1) writer.append(samples[s].name+'_');
+            writer.append(barcodes[cell]);
+            writer.appendChar('\n');
+        }
+    }
+    if (!writer.close()) return false;
+
+    //entries by column then row, as column, row and count
+    const char *kinds[]={"inc", "cnt", "skip"};
+    for (int kind=CellCounts::inc; kind<=CellCounts::skip; ++kind){
+        vector<array<uint32_t, 3>> entries;
+        for (size_t s=0; s<counters.size(); ++s)
+            for (auto &count: counters[s]->cells->counts)
+                if (count.second[kind]) entries.push_back({columns[s][(uint32_t)count.first], (uint32_t)(count.first>>32), (uint32_t)count.second[kind]});
+        sort(entries.begin(), entries.end());
+        if (!writer.open((prefix+'.'+kinds[kind]+".mtx").c_str(), 1)) return false;
+        writer.append(string("%%MatrixMarket matrix coordinate integer general\n"));
+        writer.appendInteger(introns.size());
+        writer.appendChar(' ');
+        writer.appendInteger(nColumns);
+        writer.appendChar(' ');
+        writer.appendInteger(entries.size());
+        writer.appendChar('\n');
+        for (auto &entry: entries){
+            writer.appendInteger(entry[1]+1);
+            writer.appendChar(' ');
+            writer.appendInteger(entry[0]+1);
+            writer.appendChar(' ');
+            writer.appendInteger(entry[2]);
+            writer.appendChar('\n');
+        }
+        if (!writer.close()) return false;
+    }
+    return true;
 }
 void parseArgs(int, char *[]);
-void calculateEffectiveLength(vector<struct Intron*>*);
+void calculateEffectiveLength(struct IntronSet*);
 int main(int argc, char *argv[]){
     parseArgs(argc, argv);
-    //read introns
+    //extract the introns of an annotation into an intron file
+    if (parameters->extract){
+        cerr<<"extracting introns from "<<parameters->intronFile<<endl;
+        auto introns=new struct IntronSet;
+        auto attributes=new struct IntronAttributes;
+        if (!extractIntrons(parameters->intronFile, introns, attributes)) exit(1);
+        if (!writeIntrons(parameters->outFile, *introns, *attributes)){
+            cerr<<"[error] failed to write intron file "<<parameters->outFile<<endl;
+            exit(1);
+        }
+        cerr<<"extracted "<<introns->size()<<" introns on "<<introns->chromCount<<" chromosomes"<<endl;
+        delete attributes;
+        delete introns;
+        return 0;
+    }
+
+    //read introns, either from the text file, an annotation or a prebuilt binary index
     cerr<<"loading intron file"<<endl;
-    auto introns= new vector<struct Intron*>;
-    readIntrons(introns);
+    auto introns=new struct IntronSet;
+    struct IntronIndex* indices;
+    if (isIntronIndex(parameters->intronFile)){
+        indices=mapIntronIndex(parameters->intronFile, introns);
+        if (!indices){
+            cerr<<"[error] invalid or incompatible intron index "<<parameters->intronFile<<", please rebuild it with iucount index"<<endl;
+            exit(1);
+        }
+    }
+    else {
+        if (!readIntrons(parameters->intronFile, introns)) exit(1);
+        indices=buildIndices(*introns);
+    }
+
+    //write the binary index for later runs
+    if (parameters->index){
+        if (!writeIntronIndex(parameters->outFile, *introns, indices)){
+            cerr<<"[error] failed to write intron index "<<parameters->outFile<<endl;
+            exit(1);
+        }
+        cerr<<"indexed "<<introns->size()<<" introns on "<<introns->chromCount<<" chromosomes"<<endl;
+        return 0;
+    }
 
     //check if calculate is true
     if (parameters->calculate) calculateEffectiveLength(introns);
 
-    //read bam file
+    /* the introns and indices are shared read only by all samples. Samples are taken from a queue by
+     * up to one worker per thread, the threads left over are given to the samples for their chromosomes */
     cerr<<"loading bam file"<<endl;
-    bamReader bam;
-    if (!bam.open(parameters->bamFile) || !bam.parse()) exit(1);
-
-    //prepare index for introns
-    auto skipIndices=new unordered_map<uint64_t, struct Intron*> [bam.chr2index.size()];
-    for (auto i:* introns) {
-        if (i->strand=='+') skipIndices[bam.chr2index[i->chrom]][((uint64_t)(i->chromStart)<<32u)+i->chromEnd]=i;
-        else if (i->strand=='-') skipIndices[bam.chr2index[i->chrom]][((uint64_t)(i->chromEnd)<<32u)+i->chromStart]=i;
-    }
-    auto incIndices=new vector<struct Intron*>[bam.chr2index.size()];
-    for (auto i:* introns)  incIndices[bam.chr2index[i->chrom]].push_back(i);
-    for (auto i=0; i<bam.offset.size(); ++i) sort(incIndices[i].begin(), incIndices[i].end(), compare);
-    auto incRecorder=new unordered_map<struct Intron *, int>;
-    auto cntRecorder=new unordered_map<struct Intron *, int>;
-
-    int readCount=0;
-    for (auto it=bam.offset.begin(); it != bam.offset.end(); ++it)
-    {
-        bam1_t* b;
-        int chromId=it->first;
-        bam.seek(chromId);
-        cerr<<"processing "<<bam.header->target_name[chromId]<<endl;
-
-        int32_t lastPosition=0;
-        auto incIndex=&incIndices[chromId];
-        auto skipIndex=&skipIndices[chromId];
-        int guide=0;
-
-        while ((b=bam.next())!=nullptr && b->core.tid==chromId){
-            incRecorder->clear();
-            cntRecorder->clear();
-
-            if (lastPosition>getPosition(b)) exit(12);
-            lastPosition=getPosition(b);
-
-            if (!isProper(b, parameters->isPaired, parameters->unique)) continue;
-
-            char strand=getStrand(b, parameters->isPaired, parameters->libraryType);
-            const uint32_t *cigar=getCigar(b);
-            const int cigarNum=getCigarNum(b);
-            int32_t chromStart, chromEnd, lastChromStart, lastChromEnd;
-            chromStart=getPosition(b);
-            chromEnd=chromStart;
-            lastChromStart=lastChromEnd=0;
-            int i=0;
-            int subGuide=guide;
-            while(i<cigarNum){
-                while(i<cigarNum && getCigarOp(cigar[i])!=3){ //Until an 'N' is reached or the cigar is finished
-                    if (getCigarType(cigar[i]) & 2u) chromEnd+=getCigarOplen(cigar[i]);
-                    ++i;
-                }
-                subGuide=countInc(chromStart, chromEnd, strand, incIndex, subGuide, incRecorder, cntRecorder);
-                /*if this is the first segment, record the index value returned, then for
-                 * next read the index of first overlaping intron should be more or equal to this
-                 * index                                                               */
-                if (lastChromStart==0) guide=subGuide;
-                // nothing will be count if there is no last positions
-                countSkip(chromStart, chromEnd, lastChromStart, lastChromEnd, strand, skipIndex);
-                if (i<cigarNum){
-                    lastChromStart=chromStart;
-                    lastChromEnd=chromEnd;
-                    chromStart=chromEnd+getCigarOplen(cigar[i]);
-                    chromEnd=chromStart;
-                    ++i;
-                }
+    auto &samples=parameters->samples;
+    int threads=max(parameters->threads, 1);
+    int sampleWorkers=min(threads, (int)samples.size());
+    int sampleThreads=threads/sampleWorkers;
+    struct RowWriter rows;
+    if (!rows.open(parameters->outFile, introns, samples, threads)){
+        cerr<<"[error] failed to open output file "<<parameters->outFile<<endl;
+        exit(1);
+    }
+    struct JunctionWriter junctions, *junctionWriter=nullptr;
+    if (parameters->junctionFile && !junctions.open(parameters->junctionFile, samples, threads)){
+        cerr<<"[error] failed to open junction file "<<parameters->junctionFile<<endl;
+        exit(1);
+    }
+    if (parameters->novelJunctionFile && !junctions.openNovel(parameters->novelJunctionFile, threads)){
+        cerr<<"[error] failed to open novel junction file "<<parameters->novelJunctionFile<<endl;
+        exit(1);
+    }
+    if (parameters->junctionFile || parameters->novelJunctionFile) junctionWriter=&junctions;
+    auto startTime=chrono::steady_clock::now();
+    vector<struct Counter*> counters(samples.size());
+    vector<double> sampleSeconds(samples.size());
+    atomic<size_t> nextSample(0);
+    auto work=[&](){
+        size_t s;
+        while ((s=nextSample++)<samples.size()){
+            if (samples.size()>1){
+                lock_guard<mutex> lock(logLock);
+                cerr<<"counting sample "<<samples[s].name<<" from "<<samples[s].bamFile<<endl;
             }
-            for (auto intron:*incRecorder) intron.first->incCount++;
-            for (auto intron:*cntRecorder) intron.first->cntCount++;
+            auto sampleStart=chrono::steady_clock::now();
+            counters[s]=countSample(samples[s], introns, indices, sampleThreads, [&rows, s](int chrom, const struct Counter *counter){rows.done(s, chrom, counter);}, junctionWriter);
+            sampleSeconds[s]=chrono::duration<double>(chrono::steady_clock::now()-sampleStart).count();
         }
+    };
+    vector<thread> workers;
+    for (int w=1; w<sampleWorkers; ++w) workers.emplace_back(work);
+    work();
+    for (auto &worker: workers) worker.join();
+    uint64_t readCount=0;
+    for (auto counter: counters) readCount+=counter->readCount;
+    double seconds=chrono::duration<double>(chrono::steady_clock::now()-startTime).count();
+    cerr<<"processed "<<readCount<<" records";
+    if (samples.size()>1) cerr<<" of "<<samples.size()<<" samples";
+    cerr<<" in "<<seconds<<" seconds ("<<(uint64_t)(readCount/max(seconds, 1e-9))<<" records/s, "<<threads<<" threads)"<<endl;
+
+    if (!rows.close()){
+        cerr<<"[error] failed to write output file "<<parameters->outFile<<endl;
+        exit(1);
     }
-    if (parameters->outFile!=nullptr){
-        ofstream outfile;
-        outfile.open(parameters->outFile);
-        for (auto i:*introns){
-            outfile<<i->chrom<<'\t'<<i->chromStart<<'\t'<<i->chromEnd<<'\t'<<i->strand<<'\t'<<i->incCount<<'\t'<<i->cntCount<<'\t'<<i->skipCount<<endl;
-        }
-        outfile.close();
+    if (junctionWriter && !junctions.close()){
+        cerr<<"[error] failed to write junction file "<<parameters->junctionFile<<endl;
+        exit(1);
     }
-    else for (auto i:*introns){
-            cerr<<i->chrom<<'\t'<<i->chromStart<<'\t'<<i->chromEnd<<'\t'<<i->strand<<'\t'<<i->incCount<<'\t'<<i->cntCount<<'\t'<<i->skipCount<<endl;
-        }
-    delete []incIndices;
-    delete []skipIndices;
-    delete incRecorder;
-    delete cntRecorder;
-    deleteIntrons(introns);
+    if (junctionWriter && !junctions.closeNovel()){
+        cerr<<"[error] failed to write novel junction file "<<parameters->novelJunctionFile<<endl;
+        exit(1);
+    }
+    if (parameters->matrixPrefix && !writeMatrix(parameters->matrixPrefix, *introns, counters, samples)){
+        cerr<<"[error] failed to write matrix files "<<parameters->matrixPrefix<<".*"<<endl;
+        exit(1);
+    }
+    if (parameters->statsFile) writeStats(counters, sampleSeconds, seconds, rows.seconds, threads);
+    for (auto counter: counters) delete counter;
+    delete []indices;
+    delete introns;
     return 0;
 }
-void calculateEffectiveLength(vector<struct Intron*>* introns){
+void calculateEffectiveLength(struct IntronSet* introns){
     cerr<<"the read length is "<<parameters->readLen<<endl;
     if (parameters->readLen==-1) exit(1);
-    int skipFormLen, incFormLen, cntFormLen, intronLen;
-    int span=parameters->span;
-    int readLen=parameters->readLen;
     ofstream outfile;
     outfile.open(parameters->outFile);
-    for (auto intron: *introns){
-        intronLen=intron->chromEnd-intron->chromStart;
-        skipFormLen=readLen-2*span+1;
-        incFormLen=readLen-2*span+1+min(readLen-2*span+1, intronLen);
-        cntFormLen=incFormLen+max(0, intronLen-readLen+1);
-        outfile<<intron->chrom<<'\t'<<intron->chromStart<<'\t'<<intron->chromEnd<<'\t'<<intron->strand<<
-        '\t'<<incFormLen<<'\t'<<cntFormLen<<'\t'<<skipFormLen<<endl;
+    for (size_t i=0; i<introns->size(); ++i){
+        auto length=effectiveLength(introns->ends[i]-introns->starts[i], parameters->readLen, parameters->span);
+        outfile<<introns->chromName(introns->chroms[i])<<'\t'<<introns->starts[i]<<'\t'<<introns->ends[i]<<'\t'<<introns->strands[i]<<
+        '\t'<<length.inc<<'\t'<<length.cnt<<'\t'<<length.skip<<endl;
     }
     outfile.close();
     exit(0);
 }
+//the file name of a bam file without directory and extension
+string sampleName(const string &bamFile){
+    string name=bamFile.substr(bamFile.find_last_of('/')+1);
+    size_t dot=name.find_last_of('.');
+    if (dot!=string::npos && dot>0) name.resize(dot);
+    return name;
+}
+void readSampleSheet(const char *fn, vector<struct Sample> *samples){
+    char line[100000];
+    char *items[2];
+    ifstream infile;
+    infile.open(fn);
+    if (!infile){
+        cerr<<"[error] failed to open sample sheet "<<fn<<endl;
+        exit(1);
+    }
+    infile.getline(line, 100000);
+    while (!infile.eof()){
+        if (line[0]!='#' && line[0]!='\0'){
+            split(line, items, 2);
+            if (items[1]!=nullptr) samples->push_back({items[0], items[1]});
+            else samples->push_back({sampleName(items[0]), items[0]});
+        }
+        infile.getline(line, 100000);
+    }
+    infile.close();
+}
 void usage()
 {
     fprintf(stderr, "%s", "iucount: count intron usage information from alignment file.\n\
-Usage:  iucount [options] --bam <alignment file> --intron <intron file>\n \
+Usage:  iucount [options] --bam <alignment file> --intron <intron file>\n\
+        iucount index --intron <intron file> --output <index file>\n\
+        iucount extract --intron <gtf/gff3 annotation> --output <intron file>\n \
 [options]\n\
--i/--intron                    : intron file.[required]\n\
--b/--bam                       : sorted bam alignment file.[required]\n\
+-i/--intron                    : intron file, a gtf/gff3 annotation, optionally gzipped, or a binary index\n\
+                                 written by iucount index.[required]\n\
+-b/--bam                       : sorted bam, cram or sam alignment file, may be given several times.[required]\n\
+-B/--bam-list                  : sample sheet with one bam file per line, optionally preceded by the sample name\n\
+                                 and a tab. Several samples are written as one column each of inc, cnt and skip.\n\
 -v/--version                   : show version\n\
 -h/--help                      : show help informations\n\
 -t/--library-type              : library type, one of fr-firststrand, fr-secondstrand or fr-unstranded\n\
 -p/--paried                    : whether the library is paired-end\n\
+-f/--fragment                  : count fragments instead of mates with -p, a fragment overlapping an intron with\n\
+                                 both mates counts once.\n\
+-m/--mate-buffer               : most mates waiting for their pair in fragment mode, default 1000000.\n\
 -u/--unique                    : use unique alignment only.\n\
 -s/--span                      : minimal span for segments when counting \"skip\" and \"include\", default 6. \n\
 -r/--read-length               : read length of the library, currently no need to provide except for -c. \n\
 -c/--calculate                 : calculate the effective length for each intron, read length must be provided.\n\
--o/--output                    : output file\n\
+-o/--output                    : output file, bgzf compressed and indexed by tabix if it ends in .gz or .bgz.\n\
+-T/--reference                 : reference fasta to decode cram files with, if not found from their header.\n\
+-@/--threads                   : number of threads, counting samples and the chromosomes of indexed bam files\n\
+                                 in parallel and decompressing the bam file otherwise, default 1.\n\
+-S/--stream                    : read the bam file in a single pass without seeking, implied for standard input.\n\
+--unsorted                     : count a bam file in any order, such as name sorted, in a single pass. Mates are\n\
+                                 paired by name with -f.\n\
+--barcode-tag                  : also count each cell, named by the given tag such as CB, and write the counts\n\
+                                 to the files of --matrix. Records without the tag are not counted.\n\
+--umi-tag                      : with --barcode-tag, count the distinct umis of the given tag such as UB of each\n\
+                                 intron and cell instead of records. Records without the tag are not counted.\n\
+--matrix                       : prefix of the barcode mode output: <prefix>.barcodes.tsv, <prefix>.introns.tsv\n\
+                                 and the inc, cnt and skip counts as <prefix>.inc.mtx, .cnt.mtx and .skip.mtx\n\
+                                 in matrix market format, introns by cells.\n\
+--checkpoint                   : directory of the counts of each chromosome of each sample, saved once it is\n\
+                                 counted. Chromosomes found there are restored instead of counted, so that a\n\
+                                 stopped run resumes where it was, and the checkpoints of runs counting other\n\
+                                 chromosomes, gathered in one directory, are merged by a run finding them all.\n\
+                                 A run still counting a sample refuses its checkpoints of a bam file moved or\n\
+                                 changed since, a run restoring all of it does not need the bam file.\n\
+--chroms                       : comma separated chromosomes of the intron file to count and write, all of them\n\
+                                 by default, to share the chromosomes among runs with --checkpoint.\n\
+--junctions                    : also write every junction of the reads, annotated or novel, to the given file,\n\
+                                 with its reads and the shortest anchor of its reads. Unstranded\n\
+                                 reads take the strand of their XS tag.\n\
+--novel-junctions              : also write the novel junctions of all samples to the given file as an intron\n\
+                                 file, to count them in a next run. Unstranded junctions take the strand of most\n\
+                                 of the stranded reads of the same junction, or else of the introns sharing their\n\
+                                 start or end, and are written on both strands when neither tells.\n\
+--stats                        : write statistics of the run as json to the given file: records read, filtered and\n\
+                                 spliced, introns tested, junction lookups and hits, and time spent per sample\n\
+                                 and chromosome, reads per second and peak memory.\n\
 ");
 
     exit(1);
@@ -294,13 +1054,15 @@ void parseArgs(int argc, char *argv[]){
     {
         //usage();
     }
-    const char *shortOptions = "vhcpuo:b:i:t:s:r:";
+    const char *shortOptions = "vhcpfuSo:b:B:i:t:s:r:m:T:@:";
     const struct option longOptions[] =
             {
                     { "help" , no_argument , NULL, 'h' },
                     { "version" , no_argument , NULL, 'V' },
                     { "output" , required_argument , NULL, 'o' },
                     { "bam" , required_argument, NULL, 'b' },
+                    { "bam-list" , required_argument, NULL, 'B' },
+                    { "reference" , required_argument, NULL, 'T' },
                     { "intron" , required_argument, NULL, 'i' },
                     { "library-type" , required_argument, NULL, 't' },
                     { "unique" , no_argument, NULL, 'u' },
@@ -308,11 +1070,23 @@ void parseArgs(int argc, char *argv[]){
                     { "calculate" , no_argument, NULL, 'c' },
                     { "read-length" , required_argument, NULL, 'r' },
                     { "paired" , no_argument, NULL, 'p' },
+                    { "fragment" , no_argument, NULL, 'f' },
+                    { "mate-buffer" , required_argument, NULL, 'm' },
+                    { "stream" , no_argument, NULL, 'S' },
+                    { "threads" , required_argument, NULL, '@' },
+                    { "stats" , required_argument, NULL, 1 },
+                    { "unsorted" , no_argument, NULL, 2 },
+                    { "barcode-tag" , required_argument, NULL, 3 },
+                    { "umi-tag" , required_argument, NULL, 4 },
+                    { "matrix" , required_argument, NULL, 5 },
+                    { "checkpoint" , required_argument, NULL, 6 },
+                    { "chroms" , required_argument, NULL, 7 },
+                    { "junctions" , required_argument, NULL, 8 },
+                    { "novel-junctions" , required_argument, NULL, 9 },
                     {NULL, 0, NULL, 0} ,  /* Required at end of array. */
             };
 
     parameters->intronFile=nullptr;
-    parameters->bamFile=nullptr;
     parameters->outFile=nullptr;
     parameters->isPaired=false;
     parameters->unique=false;
@@ -320,6 +1094,31 @@ void parseArgs(int argc, char *argv[]){
     parameters->span=6;
     parameters->calculate=false;
     parameters->readLen=-1;
+    parameters->stream=false;
+    parameters->unsorted=false;
+    parameters->fragment=false;
+    parameters->mateBuffer=1000000;
+    parameters->threads=1;
+    parameters->index=false;
+    parameters->extract=false;
+    parameters->reference=nullptr;
+    parameters->statsFile=nullptr;
+    parameters->barcodeTag=nullptr;
+    parameters->umiTag=nullptr;
+    parameters->matrixPrefix=nullptr;
+    parameters->checkpointDir=nullptr;
+    parameters->junctionFile=nullptr;
+    parameters->novelJunctionFile=nullptr;
+
+    //the index subcommand builds the binary intron index, the extract subcommand the intron file of an annotation
+    if (argc>1 && strcmp(argv[1], "index")==0){
+        parameters->index=true;
+        optind=2;
+    }
+    else if (argc>1 && strcmp(argv[1], "extract")==0){
+        parameters->extract=true;
+        optind=2;
+    }
 
     while ((c = getopt_long(argc, argv, shortOptions, longOptions, NULL)) >= 0)
     {
@@ -335,7 +1134,13 @@ void parseArgs(int argc, char *argv[]){
                 parameters->outFile=optarg;
                 break;
             case 'b':
-                parameters->bamFile=optarg;
+                parameters->samples.push_back({sampleName(optarg), optarg});
+                break;
+            case 'B':
+                readSampleSheet(optarg, &parameters->samples);
+                break;
+            case 'T':
+                parameters->reference=optarg;
                 break;
             case 'i':
                 parameters->intronFile=optarg;
@@ -349,6 +1154,12 @@ void parseArgs(int argc, char *argv[]){
             case 'p':
                 parameters->isPaired=true;
                 break;
+            case 'f':
+                parameters->fragment=true;
+                break;
+            case 'm':
+                parameters->mateBuffer=strtoul(optarg, nullptr, 10);
+                break;
             case 'u':
                 parameters->unique=true;
                 break;
@@ -361,6 +1172,39 @@ void parseArgs(int argc, char *argv[]){
             case 'r':
                 parameters->readLen=strtol(optarg, nullptr, 10);
                 break;
+            case 'S':
+                parameters->stream=true;
+                break;
+            case '@':
+                parameters->threads=strtol(optarg, nullptr, 10);
+                break;
+            case 1:
+                parameters->statsFile=optarg;
+                break;
+            case 2:
+                parameters->unsorted=true;
+                break;
+            case 3:
+                parameters->barcodeTag=optarg;
+                break;
+            case 4:
+                parameters->umiTag=optarg;
+                break;
+            case 5:
+                parameters->matrixPrefix=optarg;
+                break;
+            case 6:
+                parameters->checkpointDir=optarg;
+                break;
+            case 7:
+                for (char *chrom=strtok(optarg, ","); chrom; chrom=strtok(nullptr, ",")) parameters->chroms.push_back(chrom);
+                break;
+            case 8:
+                parameters->junctionFile=optarg;
+                break;
+            case 9:
+                parameters->novelJunctionFile=optarg;
+                break;
             case '?':
                 showHelp = 1;
                 break;
@@ -381,9 +1225,53 @@ void parseArgs(int argc, char *argv[]){
         usage();
         exit(1);
     }
-    if (!parameters->bamFile && !parameters->calculate) {
+    if ((parameters->index || parameters->extract) && !parameters->outFile) {
+        cerr<<"[error] please provide the output "<<(parameters->index?"index":"intron")<<" file"<<endl;
+        exit(1);
+    }
+    if (parameters->fragment && !parameters->isPaired){
+        cerr<<"[error] fragment mode needs a paired-end library, please also provide -p"<<endl;
+        exit(1);
+    }
+    for (auto tag: {parameters->barcodeTag, parameters->umiTag}) if (tag && strlen(tag)!=2){
+        cerr<<"[error] invalid tag "<<tag<<", tags are two characters"<<endl;
+        exit(1);
+    }
+    if (parameters->umiTag && !parameters->barcodeTag){
+        cerr<<"[error] umis are counted per cell, please also provide --barcode-tag"<<endl;
+        exit(1);
+    }
+    if ((parameters->barcodeTag!=nullptr)!=(parameters->matrixPrefix!=nullptr)){
+        cerr<<"[error] --barcode-tag and --matrix go together"<<endl;
+        exit(1);
+    }
+    if (parameters->checkpointDir && parameters->barcodeTag){
+        cerr<<"[error] the counts of cells are not saved in checkpoints, --checkpoint can not be used with --barcode-tag"<<endl;
+        exit(1);
+    }
+    if (parameters->checkpointDir && (parameters->junctionFile || parameters->novelJunctionFile)){
+        cerr<<"[error] the junctions are not saved in checkpoints, --checkpoint can not be used with --junctions"<<endl;
+        exit(1);
+    }
+    if (parameters->checkpointDir && mkdir(parameters->checkpointDir, 0777)!=0 && errno!=EEXIST){
+        cerr<<"[error] failed to create checkpoint directory "<<parameters->checkpointDir<<endl;
+        exit(1);
+    }
+    if (parameters->samples.empty() && !parameters->calculate && !parameters->index && !parameters->extract) {
         cerr<<"[warning] bam file not provided, read from standard input"<<endl;
-        parameters->bamFile = "/dev/stdin";
+        parameters->samples.push_back({"stdin", "/dev/stdin"});
+    }
+    for (auto &sample: parameters->samples){
+        if (sample.bamFile!="-" && sample.bamFile!="/dev/stdin") continue;
+        if (parameters->samples.size()>1){
+            cerr<<"[error] standard input can not be read along with other samples"<<endl;
+            exit(1);
+        }
+        if (parameters->checkpointDir){
+            cerr<<"[error] checkpoints are restored from the same bam file, --checkpoint can not be used with standard input"<<endl;
+            exit(1);
+        }
+        parameters->stream=true;
     }
 
     if (!parameters->outFile) {
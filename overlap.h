@@ -0,0 +1,132 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+
+#ifndef IUCOUNT_OVERLAP_H
+#define IUCOUNT_OVERLAP_H
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/* tests of a read segment [start, end) against up to 64 consecutive introns of an index, sorted by
+ * start and given by their starts, ends and strands. Bit j of inc is set when intron j is overlapped
+ * by at least span bases with span bases of the segment on one side of it, bit j of cnt when the
+ * segment covers the whole intron, both only for introns on the strand of the segment unless it is '.'.
+ * The vector versions test 8 or 4 introns at once and compare the strands afterwards, only for the
+ * introns passing the other tests. */
+typedef void (*IntronTest)(const int32_t *starts, const int32_t *ends, const char *strands, int count, int32_t start, int32_t end, char strand, int span, uint64_t *inc, uint64_t *cnt);
+
+inline void testIntronsScalar(const int32_t *starts, const int32_t *ends, const char *strands, int count, int32_t start, int32_t end, char strand, int span, uint64_t *inc, uint64_t *cnt){
+    uint64_t incMask=0, cntMask=0;
+    for (int j=0; j<count && starts[j]<end; ++j){
+        if (ends[j]<=start) continue;
+        if (strand!='.' && strand!=strands[j]) continue;
+        int32_t overlap=(ends[j]<end?ends[j]:end)-(starts[j]>start?starts[j]:start);
+        if (overlap<span) continue;
+        int32_t leftSpan=starts[j]-start, rightSpan=end-ends[j];
+        if (leftSpan>=span || rightSpan>=span) incMask|=1ull<<j;
+        if (leftSpan<=0 && rightSpan<=0) cntMask|=1ull<<j;
+    }
+    *inc=incMask;
+    *cnt=cntMask;
+}
+
+//the strands are only compared for the few introns passing the other tests
+inline void keepStrand(const char *strands, char strand, uint64_t *inc, uint64_t *cnt){
+    if (strand=='.') return;
+    uint64_t keep=0;
+    for (uint64_t hit=*inc|*cnt; hit; hit&=hit-1)
+        if (strands[__builtin_ctzll(hit)]==strand) keep|=hit&-hit;
+    *inc&=keep;
+    *cnt&=keep;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) inline void testIntronsAvx2(const int32_t *starts, const int32_t *ends, const char *strands, int count, int32_t start, int32_t end, char strand, int span, uint64_t *inc, uint64_t *cnt){
+    const __m256i lanes=_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i vStart=_mm256_set1_epi32(start), vEnd=_mm256_set1_epi32(end);
+    const __m256i vSpan=_mm256_set1_epi32(span-1), zero=_mm256_setzero_si256();
+    uint64_t incMask=0, cntMask=0;
+    for (int base=0; base<count && starts[base]<end; base+=8){
+        //the lanes past the range are neither loaded nor set
+        __m256i valid=_mm256_cmpgt_epi32(_mm256_set1_epi32(count-base), lanes);
+        __m256i s=_mm256_maskload_epi32(starts+base, valid);
+        __m256i e=_mm256_maskload_epi32(ends+base, valid);
+        __m256i overlap=_mm256_sub_epi32(_mm256_min_epi32(e, vEnd), _mm256_max_epi32(s, vStart));
+        __m256i hit=_mm256_and_si256(valid, _mm256_and_si256(_mm256_cmpgt_epi32(vEnd, s), _mm256_cmpgt_epi32(e, vStart)));
+        hit=_mm256_and_si256(hit, _mm256_cmpgt_epi32(overlap, vSpan));
+        __m256i leftSpan=_mm256_sub_epi32(s, vStart), rightSpan=_mm256_sub_epi32(vEnd, e);
+        __m256i incLanes=_mm256_and_si256(hit, _mm256_or_si256(_mm256_cmpgt_epi32(leftSpan, vSpan), _mm256_cmpgt_epi32(rightSpan, vSpan)));
+        __m256i cntLanes=_mm256_andnot_si256(_mm256_or_si256(_mm256_cmpgt_epi32(leftSpan, zero), _mm256_cmpgt_epi32(rightSpan, zero)), hit);
+        incMask|=(uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(incLanes))<<base;
+        cntMask|=(uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(cntLanes))<<base;
+    }
+    keepStrand(strands, strand, &incMask, &cntMask);
+    *inc=incMask;
+    *cnt=cntMask;
+}
+__attribute__((target("sse4.1"))) inline void testIntronsSse4(const int32_t *starts, const int32_t *ends, const char *strands, int count, int32_t start, int32_t end, char strand, int span, uint64_t *inc, uint64_t *cnt){
+    if (count<4){
+        testIntronsScalar(starts, ends, strands, count, start, end, strand, span, inc, cnt);
+        return;
+    }
+    const __m128i vStart=_mm_set1_epi32(start), vEnd=_mm_set1_epi32(end);
+    const __m128i vSpan=_mm_set1_epi32(span-1), zero=_mm_setzero_si128();
+    uint64_t incMask=0, cntMask=0;
+    for (int base=0; base<count && starts[base]<end; base+=4){
+        //the last four introns are loaded for a partial tail, dropping the lanes already tested
+        int offset=base+4<=count?base:count-4;
+        __m128i s=_mm_loadu_si128((const __m128i*)(starts+offset));
+        __m128i e=_mm_loadu_si128((const __m128i*)(ends+offset));
+        __m128i overlap=_mm_sub_epi32(_mm_min_epi32(e, vEnd), _mm_max_epi32(s, vStart));
+        __m128i hit=_mm_and_si128(_mm_cmpgt_epi32(vEnd, s), _mm_cmpgt_epi32(e, vStart));
+        hit=_mm_and_si128(hit, _mm_cmpgt_epi32(overlap, vSpan));
+        __m128i leftSpan=_mm_sub_epi32(s, vStart), rightSpan=_mm_sub_epi32(vEnd, e);
+        __m128i incLanes=_mm_and_si128(hit, _mm_or_si128(_mm_cmpgt_epi32(leftSpan, vSpan), _mm_cmpgt_epi32(rightSpan, vSpan)));
+        __m128i cntLanes=_mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi32(leftSpan, zero), _mm_cmpgt_epi32(rightSpan, zero)), hit);
+        incMask|=((uint64_t)_mm_movemask_ps(_mm_castsi128_ps(incLanes))>>(base-offset))<<base;
+        cntMask|=((uint64_t)_mm_movemask_ps(_mm_castsi128_ps(cntLanes))>>(base-offset))<<base;
+    }
+    keepStrand(strands, strand, &incMask, &cntMask);
+    *inc=incMask;
+    *cnt=cntMask;
+}
+#endif
+
+/* the vector test used by countInc, none without avx2, where the introns are tested one at a time
+ * inline. The sse4.1 test does not beat the inline loop with its 4 lanes and is only benchmarked */
+inline IntronTest selectIntronTest(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return testIntronsAvx2;
+#endif
+    return nullptr;
+}
+static IntronTest testIntrons=selectIntronTest();
+
+#endif
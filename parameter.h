@@ -0,0 +1,76 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_PARAMETER_H
+#define IUCOUNT_PARAMETER_H
+
+#include <string>
+#include <vector>
+#include "count.h"
+using namespace std;
+
+//a bam file to count and the name of its columns in the output
+struct Sample{
+    string name;
+    string bamFile;
+};
+/* the settings of the command line, shared by the iucount program and the benchmarks, which each define
+ * parameters. libiucount does not include this header, its counters only depend on their CountSettings */
+struct Parameter{
+    char* intronFile;
+    vector<struct Sample> samples;
+    char* outFile;
+    bool isPaired;
+    int libraryType;
+    int span;
+    int readLen;
+    bool calculate;
+    bool unique;
+    bool stream;
+    bool unsorted;
+    bool fragment;
+    size_t mateBuffer;
+    int threads;
+    bool index;
+    bool extract;
+    char* reference;
+    char* statsFile;
+    char* barcodeTag;
+    char* umiTag;
+    char* matrixPrefix;
+    char* checkpointDir;
+    vector<string> chroms;
+    char* junctionFile;
+    char* novelJunctionFile;
+};
+extern struct Parameter *parameters;
+//the settings as given in the parameters of the command line
+struct RuntimeLibrary{
+    static const bool stats=false;
+    static bool proper(bam1_t *b){return isProper(b, parameters->isPaired, parameters->unique);}
+    static char strand(bam1_t *b){return getStrand(b, parameters->isPaired, parameters->libraryType);}
+};
+
+#endif
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Checkpoints of the chromosomes of a sample counted by separate runs, merged by a run restoring them all
+# without the bam file, against a single run counting everything. A run still counting a chromosome
+# refuses the checkpoints of a bam file changed since. Run by ctest.
+#   test/checkpoint.sh <build directory>
+set -e
+BUILD=$(cd "${1:?usage: checkpoint.sh <build directory>}" && pwd)
+DATA=$BUILD/test-checkpoint
+rm -rf "$DATA"
+mkdir -p "$DATA"
+"$BUILD/benchdata" -o "$DATA/sample" -C 3 -g 40 -d 10 2>/dev/null
+INTRONS=$DATA/sample.introns.txt
+count(){ "$BUILD/iucount" -i "$INTRONS" -b "$DATA/sample.bam" -S "$@" 2>"$DATA/log.txt" </dev/null; }
+
+failed=0
+count -o "$DATA/whole.txt"
+count -o "$DATA/part1.txt" --checkpoint "$DATA/checkpoints" --chroms chr1
+count -o "$DATA/part2.txt" --checkpoint "$DATA/checkpoints" --chroms chr2,chr3
+mv "$DATA/sample.bam" "$DATA/moved.bam"
+if count -o "$DATA/merged.txt" --checkpoint "$DATA/checkpoints" && cmp -s "$DATA/whole.txt" "$DATA/merged.txt"; then
+    echo "ok checkpoints merged without the bam file"
+else
+    echo "FAILED the checkpoints merged without the bam file differ from a single run"
+    failed=1
+fi
+mv "$DATA/moved.bam" "$DATA/sample.bam"
+rm "$DATA/checkpoints/sample.chr3.iuc"
+touch -d '1 hour ago' "$DATA/sample.bam"
+if count -o "$DATA/resumed.txt" --checkpoint "$DATA/checkpoints"; then
+    echo "FAILED the checkpoints of a changed bam file were restored"
+    failed=1
+elif grep -q "has changed since checkpoint" "$DATA/log.txt"; then echo "ok checkpoints of a changed bam file refused"
+else
+    echo "FAILED resuming with a changed bam file: $(cat "$DATA/log.txt")"
+    failed=1
+fi
+rm -rf "$DATA"
+exit $failed
@@ -0,0 +1,156 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+/* libiucount through its C interface: the records of a bam file are decoded here and pushed in batches to
+ * one or more counters, which are merged, and the counts are written as the rows of iucount, so that
+ * test/run.sh compares them with those of iucount on the same file.
+ *   libtest [-p] [-f] [-u] [-S] [-T] [-t library type] [-s span] [-n counters] <introns> <bam> <output>
+ * -S pushes the records sorted, otherwise as unsorted records. With several counters the records of a
+ * chromosome all go to the same counter, so that mates stay together in fragment mode, and with -T each
+ * counter is pushed its records from a thread of its own, all at once */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <htslib/sam.h>
+#include "../iucount.h"
+
+#define BATCH 256
+
+static void usage(void){
+    fprintf(stderr, "Usage: libtest [-p] [-f] [-u] [-S] [-T] [-t library type] [-s span] [-n counters] <introns> <bam> <output>\n");
+    exit(1);
+}
+//the records of a counter, pushed in batches
+struct Pushed{
+    struct IucountCounter *counter;
+    bam1_t **records;
+    size_t n, capacity;
+    int failed;
+};
+static void* pushAll(void *arg){
+    struct Pushed *pushed=arg;
+    for (size_t i=0; i<pushed->n; i+=BATCH)
+        pushed->failed|=iucountPush(pushed->counter, pushed->records+i, pushed->n-i<BATCH?pushed->n-i:BATCH)!=0;
+    return NULL;
+}
+int main(int argc, char *argv[]){
+    struct IucountOptions options;
+    int c, counterCount=1, threaded=0;
+    iucountInitOptions(&options);
+    while ((c=getopt(argc, argv, "pfuSTt:s:n:"))>=0){
+        switch (c){
+            case 'p': options.paired=true; break;
+            case 'f': options.fragment=true; break;
+            case 'u': options.unique=true; break;
+            case 'S': options.sorted=true; break;
+            case 'T': threaded=1; break;
+            case 's': options.span=atoi(optarg); break;
+            case 'n': counterCount=atoi(optarg); break;
+            case 't':
+                if (strcmp(optarg, "fr-firststrand")==0) options.libraryType=IUCOUNT_FR_FIRSTSTRAND;
+                else if (strcmp(optarg, "fr-secondstrand")==0) options.libraryType=IUCOUNT_FR_SECONDSTRAND;
+                else if (strcmp(optarg, "fr-unstranded")==0) options.libraryType=IUCOUNT_FR_UNSTRANDED;
+                else usage();
+                break;
+            default: usage();
+        }
+    }
+    if (argc-optind!=3 || counterCount<1) usage();
+    struct IucountIntrons *introns=iucountLoadIntrons(argv[optind]);
+    if (!introns) return 1;
+    samFile *in=sam_open(argv[optind+1], "r");
+    sam_hdr_t *header=in?sam_hdr_read(in):NULL;
+    if (!header){
+        fprintf(stderr, "[error] failed to read %s\n", argv[optind+1]);
+        return 1;
+    }
+    struct IucountCounter **counters=calloc(counterCount, sizeof(struct IucountCounter*));
+    struct Pushed *pushed=calloc(counterCount, sizeof(struct Pushed));
+    for (int i=0; i<counterCount; ++i){
+        if (!(counters[i]=iucountCreateCounter(introns, header, &options))) return 1;
+        pushed[i].counter=counters[i];
+    }
+    //the records are read first, then pushed to the counters one after another or from their threads
+    bam1_t *record=bam_init1();
+    int ret, failed=0;
+    while ((ret=sam_read1(in, header, record))>=0){
+        struct Pushed *to=pushed+(record->core.tid<0?0:record->core.tid%counterCount);
+        if (to->n==to->capacity){
+            to->capacity=to->capacity?2*to->capacity:BATCH;
+            to->records=realloc(to->records, to->capacity*sizeof(bam1_t*));
+        }
+        to->records[to->n++]=bam_dup1(record);
+    }
+    if (threaded){
+        pthread_t *threads=calloc(counterCount, sizeof(pthread_t));
+        for (int i=0; i<counterCount; ++i) if (pthread_create(threads+i, NULL, pushAll, pushed+i)!=0) return 1;
+        for (int i=0; i<counterCount; ++i) pthread_join(threads[i], NULL);
+        free(threads);
+    }
+    else for (int i=0; i<counterCount; ++i) pushAll(pushed+i);
+    for (int i=0; i<counterCount; ++i) failed|=pushed[i].failed;
+    if (ret<-1 || failed){
+        fprintf(stderr, "[error] failed to count %s\n", argv[optind+1]);
+        return 1;
+    }
+    for (int i=0; i<counterCount; ++i) iucountFinish(counters[i]);
+    for (int i=1; i<counterCount; ++i) if (!iucountMerge(counters[0], counters[i])) return 1;
+
+    //the rows of iucount: chromosomes in order of first appearance, introns in file order within each
+    FILE *out=fopen(argv[optind+2], "w");
+    if (!out) return 1;
+    struct IucountCounts counts=iucountCounts(counters[0]);
+    char *written=calloc(counts.n, 1);
+    for (size_t i=0; i<counts.n; ++i){
+        const char *chrom, *other;
+        uint32_t start, end;
+        char strand;
+        if (written[i]) continue;
+        iucountIntron(introns, i, &chrom, &start, &end, &strand);
+        for (size_t j=i; j<counts.n; ++j){
+            iucountIntron(introns, j, &other, &start, &end, &strand);
+            if (strcmp(chrom, other)!=0) continue;
+            fprintf(out, "%s\t%u\t%u\t%c\t%d\t%d\t%d\n", other, start, end, strand, counts.inc[j], counts.cnt[j], counts.skip[j]);
+            written[j]=1;
+        }
+    }
+    if (fclose(out)!=0) return 1;
+    for (int i=0; i<counterCount; ++i){
+        iucountDestroyCounter(counters[i]);
+        for (size_t j=0; j<pushed[i].n; ++j) bam_destroy1(pushed[i].records[j]);
+        free(pushed[i].records);
+    }
+    bam_destroy1(record);
+    free(written);
+    free(counters);
+    free(pushed);
+    iucountDestroyIntrons(introns);
+    sam_hdr_destroy(header);
+    sam_close(in);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#!/bin/bash
+# The counts of iucount and of libiucount, pushed by test/libtest, against those worked out by hand for the
+# reads of test/data, then the counts of libiucount against those of iucount on the same synthetic data sets
+# written by benchdata, for sorted and unsorted pushes and for several counters merged, pushed one after
+# another or from threads of their own. Run by ctest.
+#   test/run.sh <build directory>
+set -e
+BUILD=$(cd "${1:?usage: run.sh <build directory>}" && pwd)
+DATA=$BUILD/test-data
+mkdir -p "$DATA"
+"$BUILD/benchdata" -o "$DATA/single" -C 3 -g 40 -d 10 2>/dev/null
+"$BUILD/benchdata" -o "$DATA/paired" -C 3 -g 40 -d 10 -p -t fr-firststrand 2>/dev/null
+
+failed=0
+# test/data/counts.<library type>.txt: the counts of test/data/reads.sam, single end with a span of 6
+FIXTURE=$(dirname "$0")/data
+for library in fr-unstranded fr-secondstrand; do
+    expected=$FIXTURE/counts.$library.txt
+    "$BUILD/iucount" -i "$FIXTURE/introns.txt" -b "$FIXTURE/reads.sam" -t $library -o "$DATA/iucount.txt" 2>/dev/null </dev/null
+    "$BUILD/libtest" -S -t $library "$FIXTURE/introns.txt" "$FIXTURE/reads.sam" "$DATA/libtest.txt"
+    for counted in iucount libtest; do
+        if cmp -s "$expected" "$DATA/$counted.txt"; then echo "ok $counted test/data $library"
+        else
+            echo "FAILED $counted test/data $library: the counts differ from $expected"
+            failed=1
+        fi
+    done
+done
+# data set, options of iucount, options of libtest
+while IFS=: read -r name options libOptions; do
+    "$BUILD/iucount" -i "$DATA/$name.introns.txt" -b "$DATA/$name.bam" $options -o "$DATA/iucount.txt" 2>/dev/null </dev/null
+    "$BUILD/libtest" $libOptions "$DATA/$name.introns.txt" "$DATA/$name.bam" "$DATA/libtest.txt"
+    if cmp -s "$DATA/iucount.txt" "$DATA/libtest.txt"; then echo "ok $name $libOptions"
+    else
+        echo "FAILED $name $libOptions: the counts differ from iucount $options"
+        failed=1
+    fi
+done <<'CONFIGS'
+single::-S
+single::
+single:-u -s 3:-u -s 3 -S -n 3
+paired:-p -t fr-firststrand:-p -t fr-firststrand -S -n 2
+paired:-p -t fr-firststrand -f:-p -t fr-firststrand -f -S
+paired:-p -f:-p -f -n 3
+single::-S -n 3 -T
+paired:-p -t fr-firststrand:-p -t fr-firststrand -n 2 -T
+CONFIGS
+rm -f "$DATA/iucount.txt" "$DATA/libtest.txt"
+exit $failed
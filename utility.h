@@ -23,38 +23,113 @@
    SOFTWARE.
  */
 
+#ifndef IUCOUNT_UTILITY_H
+#define IUCOUNT_UTILITY_H
+
+#include <string.h>
 #include <htslib/sam.h>
+#include "bam.h"
 
 #define getAuxInteger(b, tag) bam_aux2i(bam_aux_get((b), (tag)))
-bool isProper(bam1_t* b, bool isPaired, bool unique){
+//size of an aux value of a fixed size type, 0 for other types
+inline int auxTypeSize(char type){
+    switch (type){
+        case 'A': case 'c': case 'C': return 1;
+        case 's': case 'S': return 2;
+        case 'i': case 'I': case 'f': return 4;
+        case 'd': return 8;
+        default: return 0;
+    }
+}
+/* the value of the NH tag, -1 if it is missing or not an integer. The tags are walked in place and the
+ * walk stops at the first NH, which aligners write among the first tags */
+inline int64_t getNH(const bam1_t *b){
+    const uint8_t *s=bam_get_aux(b), *end=b->data+b->l_data;
+    while (end-s>=4){
+        char type=s[2];
+        const uint8_t *v=s+3;
+        uint64_t size=auxTypeSize(type);
+        if (s[0]=='N' && s[1]=='H'){
+            if (size>(uint64_t)(end-v)) return -1;
+            switch (type){
+                case 'c': return (int8_t)v[0];
+                case 'C': return v[0];
+                case 's': {int16_t x; memcpy(&x, v, 2); return x;}
+                case 'S': {uint16_t x; memcpy(&x, v, 2); return x;}
+                case 'i': {int32_t x; memcpy(&x, v, 4); return x;}
+                case 'I': {uint32_t x; memcpy(&x, v, 4); return x;}
+                default: return -1;
+            }
+        }
+        if (type=='Z' || type=='H'){
+            v=(const uint8_t*)memchr(v, 0, end-v);
+            if (!v) return -1;
+            size=1;
+        }
+        else if (type=='B'){
+            uint32_t n;
+            if (end-v<5) return -1;
+            memcpy(&n, v+1, 4);
+            if (auxTypeSize(v[0])==0) return -1;
+            size=5+(uint64_t)n*auxTypeSize(v[0]);
+        }
+        else if (size==0) return -1;
+        //a corrupt length would walk out of the record
+        if (size>(uint64_t)(end-v)) return -1;
+        s=v+size;
+    }
+    return -1;
+}
+//the value of a string tag, nullptr if it is missing or not a string
+inline const char* getAuxString(const bam1_t *b, const char tag[2]){
+    const uint8_t *s=bam_aux_get(b, tag);
+    return s && *s=='Z'?(const char*)s+1:nullptr;
+}
+template<bool isPaired, bool unique> inline bool isProper(bam1_t* b){
     if (isPaired && !isProperPair(b)) return false;
-    if (unique && getAuxInteger(b, "NH")!=1) return false;
+    if (unique && getNH(b)!=1) return false;
     return true;
 }
+inline bool isProper(bam1_t* b, bool isPaired, bool unique){
+    if (isPaired) return unique?isProper<true, true>(b):isProper<true, false>(b);
+    return unique?isProper<false, true>(b):isProper<false, false>(b);
+}
+//whether the alignment skips a region of the reference, an intron
+inline bool isSpliced(const bam1_t *b){
+    const uint32_t *cigar=getCigar(b);
+    for (uint32_t i=0; i<getCigarNum(b); ++i) if (getCigarOp(cigar[i])==BAM_CREF_SKIP) return true;
+    return false;
+}
 #define FRUNSTRANDED 0
 #define FRFIRSTSTRAND 1
 #define FRSECONDSTRAND 2
-char getStrand(bam1_t *b, bool isPaired, int libraryType){
+template<int libraryType, bool isPaired> inline char getStrand(bam1_t *b){
+    if (libraryType==FRUNSTRANDED) return '.';
+    if (!isPaired){
+        if (libraryType==FRFIRSTSTRAND) return isReverse(b)?'+':'-';
+        else return isReverse(b)?'-':'+';
+    }
     if (libraryType==FRFIRSTSTRAND){
-        if (isPaired){
-            if ((isFirstMate(b) && isReverse(b)) || (isSecondMate(b) && isMateReverse(b)))
-                return '+';
-            else if ((isFirstMate(b) && isMateReverse(b)) || (isSecondMate(b) && isReverse(b)))
-                return '-';
-        }
-        else ((isReverse(b)?'+':'-'));
+        if ((isFirstMate(b) && isReverse(b)) || (isSecondMate(b) && isMateReverse(b)))
+            return '+';
+        else if ((isFirstMate(b) && isMateReverse(b)) || (isSecondMate(b) && isReverse(b)))
+            return '-';
     }
-    else if (libraryType==FRSECONDSTRAND){
-        if (isPaired){
-            if ((isFirstMate(b) && isMateReverse(b)) || (isSecondMate(b) && isReverse(b)))
-                return '+';
-            else if ((isFirstMate(b) && isReverse(b)) || (isSecondMate(b) && isMateReverse(b)))
-                return '-';
-        }
-        else ((isReverse(b)?'-':'+'));
+    else {
+        if ((isFirstMate(b) && isMateReverse(b)) || (isSecondMate(b) && isReverse(b)))
+            return '+';
+        else if ((isFirstMate(b) && isReverse(b)) || (isSecondMate(b) && isMateReverse(b)))
+            return '-';
     }
+    return 0; //a record flagged as neither mate has no strand and counts nothing
+}
+inline char getStrand(bam1_t *b, bool isPaired, int libraryType){
+    if (libraryType==FRFIRSTSTRAND) return isPaired?getStrand<FRFIRSTSTRAND, true>(b):getStrand<FRFIRSTSTRAND, false>(b);
+    else if (libraryType==FRSECONDSTRAND) return isPaired?getStrand<FRSECONDSTRAND, true>(b):getStrand<FRSECONDSTRAND, false>(b);
     else if (libraryType==FRUNSTRANDED) return '.';
-    exit(1);
+    return 0;
 }
 #define max(a, b) (((a)>(b))?(a):(b))
-#define min(a, b) (((a)>(b))?(b):(a))
\ No newline at end of file
+#define min(a, b) (((a)>(b))?(b):(a))
+
+#endif
@@ -0,0 +1,125 @@
+/* The MIT License (MIT)
+
+   Copyright (c) 2023 Anrui Liu <liuar6@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining
+   a copy of this software and associated documentation files (the
+   “Software”), to deal in the Software without restriction, including
+   without limitation the rights to use, copy, modify, merge, publish,
+   distribute, sublicense, and/or sell copies of the Software, and to
+   permit persons to whom the Software is furnished to do so, subject to
+   the following conditions:
+
+   The above copyright notice and this permission notice shall be
+   included in all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND,
+   EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+   MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+   NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+   BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+   ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+ */
+
+#ifndef IUCOUNT_WRITER_H
+#define IUCOUNT_WRITER_H
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <htslib/bgzf.h>
+#include <htslib/tbx.h>
+using namespace std;
+
+//output names ending in .gz or .bgz are written bgzf compressed
+inline bool isCompressedName(const char *fn){
+    size_t n=strlen(fn);
+    return (n>3 && strcmp(fn+n-3, ".gz")==0) || (n>4 && strcmp(fn+n-4, ".bgz")==0);
+}
+/* text output gathered in a large buffer, with integers formatted by hand instead of through iostreams.
+ * Compressed output is written as bgzf with threads for the compression, and indexed by tabix as bed
+ * once closed, which needs the rows of a chromosome together and sorted by start */
+struct ResultWriter{
+    static const size_t bufferSize=1<<20;
+    string fn;
+    FILE *file=nullptr;
+    BGZF *bgzf=nullptr;
+    char *buffer=nullptr;
+    size_t used=0;
+    bool failed=false;
+    bool open(const char *fn, int threads){
+        this->fn=fn;
+        if (isCompressedName(fn)){
+            bgzf=bgzf_open(fn, "w");
+            if (!bgzf) return false;
+            if (threads>1) bgzf_mt(bgzf, threads, 256);
+        }
+        else if (!(file=fopen(fn, "w"))) return false;
+        buffer=new char[bufferSize];
+        return true;
+    }
+    bool compressed() const{return bgzf!=nullptr;}
+    void flush(){
+        if (used==0) return;
+        if (bgzf) failed|=bgzf_write(bgzf, buffer, used)!=(ssize_t)used;
+        else failed|=fwrite(buffer, 1, used, file)!=used;
+        used=0;
+    }
+    //room for n more characters, n is at most bufferSize
+    char* reserve(size_t n){
+        if (used+n>bufferSize) flush();
+        return buffer+used;
+    }
+    void append(const char *s, size_t n){
+        if (n>bufferSize){
+            flush();
+            if (bgzf) failed|=bgzf_write(bgzf, s, n)!=(ssize_t)n;
+            else failed|=fwrite(s, 1, n, file)!=n;
+            return;
+        }
+        memcpy(reserve(n), s, n);
+        used+=n;
+    }
+    void append(const string &s){append(s.data(), s.size());}
+    void append(const char *s){append(s, strlen(s));}
+    void appendChar(char c){
+        *reserve(1)=c;
+        ++used;
+    }
+    void appendInteger(int64_t value){
+        char *p=reserve(20), digits[20];
+        uint64_t magnitude=value;
+        if (value<0){
+            *p++='-';
+            magnitude=-magnitude;
+        }
+        int n=0;
+        do {
+            digits[n++]='0'+magnitude%10;
+            magnitude/=10;
+        } while (magnitude);
+        while (n) *p++=digits[--n];
+        used=p-buffer;
+    }
+    //returns false if anything failed to be written
+    bool close(){
+        flush();
+        delete []buffer;
+        buffer=nullptr;
+        if (bgzf){
+            failed|=bgzf_close(bgzf)<0;
+            bgzf=nullptr;
+            if (!failed && tbx_index_build(fn.c_str(), 0, &tbx_conf_bed)<0)
+                cerr<<"[warning] failed to index "<<fn<<" with tabix"<<endl;
+        }
+        else if (file){
+            failed|=fclose(file)!=0;
+            file=nullptr;
+        }
+        return !failed;
+    }
+};
+#endif